@@ -0,0 +1,249 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+// Measures what the library adds around the loader: loading, resolving
+// exports, creating and destroying interfaces and calling through them.
+// Built against Google Benchmark, along with fixture_plugin.cc as a shared
+// library, see CMakeLists.txt, and run as
+//
+//   dynamic_library_benchmark [benchmark flags] [path of the fixture plugin]
+//
+// The variants run on several threads share the loader lock.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <string>
+
+#include "../dynamic_library_interface.h"
+
+namespace {
+
+struct Foo {
+    int value;
+};
+
+#if defined(_WIN32)
+std::wstring g_plugin_path = L"fixture_plugin.dll";
+#else
+std::wstring g_plugin_path = L"./libfixture_plugin.so";
+#endif
+
+// Holds the plugin loaded for the benchmarks which don't measure loading,
+// from the first of them on.
+std::shared_ptr<utils::DynamicLibrary> Plugin() {
+    static auto plugin = std::make_shared<utils::DynamicLibrary>(g_plugin_path);
+    return plugin;
+}
+
+// The name the plugin is found by once loaded, for the wellknown library
+// paths. Windows matches the file name, dlopen(RTLD_NOLOAD) the path it was
+// loaded by, the fixture has no SONAME.
+std::wstring PluginName() {
+#if defined(_WIN32)
+    auto separator = g_plugin_path.find_last_of(L"/\\");
+    if (separator == std::wstring::npos) return g_plugin_path;
+    return g_plugin_path.substr(separator + 1);
+#else
+    return g_plugin_path;
+#endif
+}
+
+constexpr utils::Symbol<int, int, int> kAdd("Add");
+
+// Runs first, before the plugin is kept loaded, so that every iteration maps
+// and initializes it. On one thread only, concurrent loads would share one
+// mapping and most of them only move its reference count.
+void BM_Load(benchmark::State& state) {
+    for (auto _ : state) {
+        utils::DynamicLibrary library(g_plugin_path);
+        if (!library.is_valid()) {
+            state.SkipWithError("can't load the fixture plugin");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_Load)->UseRealTime();
+
+// Loads while the plugin stays mapped, only the reference count moves.
+void BM_LoadResident(benchmark::State& state) {
+    auto plugin = Plugin();
+    for (auto _ : state) {
+        utils::DynamicLibrary library(g_plugin_path);
+        benchmark::DoNotOptimize(library.native_library());
+    }
+}
+BENCHMARK(BM_LoadResident)->ThreadRange(1, 8)->UseRealTime();
+
+// The loader alone, what the symbol cache saves.
+void BM_GetFunctionPointerNative(benchmark::State& state) {
+    auto plugin = Plugin();
+    auto native = plugin->native_library();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(internal::GetFunctionPointerFromNativeLibrary(native, "Add"));
+    }
+}
+BENCHMARK(BM_GetFunctionPointerNative)->ThreadRange(1, 8);
+
+void BM_GetFunctionPointerByName(benchmark::State& state) {
+    auto plugin = Plugin();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(plugin->GetFunctionPointer("Add"));
+    }
+}
+BENCHMARK(BM_GetFunctionPointerByName)->ThreadRange(1, 8);
+
+void BM_GetFunctionPointerBySymbol(benchmark::State& state) {
+    auto plugin = Plugin();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(plugin->GetFunctionPointer(kAdd));
+    }
+}
+BENCHMARK(BM_GetFunctionPointerBySymbol)->ThreadRange(1, 8);
+
+#if defined(_WIN32)
+// See fixture_plugin.def, ELF has no ordinals.
+constexpr int kAddOrdinal = 4;
+
+void BM_GetFunctionPointerByOrdinal(benchmark::State& state) {
+    auto plugin = Plugin();
+    if (!plugin->GetFunctionPointer(kAddOrdinal)) {
+        state.SkipWithError("the fixture plugin has no ordinals");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(plugin->GetFunctionPointer(kAddOrdinal));
+    }
+}
+BENCHMARK(BM_GetFunctionPointerByOrdinal)->ThreadRange(1, 8);
+#endif  // defined(_WIN32)
+
+// The wellknown library is pinned by the first lookup, the others hit the
+// symbol cache.
+void BM_GetFunctionPointerWellKnown(benchmark::State& state) {
+    auto plugin = Plugin();
+    auto name = PluginName();
+    utils::DynamicLibrary library(name.c_str());
+    if (!library.GetFunctionPointer("Add")) {
+        state.SkipWithError("the fixture plugin isn't found by name");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(library.GetFunctionPointer("Add"));
+    }
+}
+BENCHMARK(BM_GetFunctionPointerWellKnown)->ThreadRange(1, 8);
+
+void BM_InterfacePointerTraits(benchmark::State& state) {
+    auto plugin = Plugin();
+    for (auto _ : state) {
+        utils::Interface<Foo> foo(plugin, "CreateFoo", "DestroyFoo", 1);
+        benchmark::DoNotOptimize(foo.get());
+    }
+}
+BENCHMARK(BM_InterfacePointerTraits)->ThreadRange(1, 8);
+
+void BM_InterfaceDoublePointerTraits(benchmark::State& state) {
+    auto plugin = Plugin();
+    for (auto _ : state) {
+        utils::Interface<Foo, utils::subtle::DoublePointerTraits<Foo>> foo(plugin, "CreateFoo", "DestroyFooPointer", 1);
+        benchmark::DoNotOptimize(foo.get());
+    }
+}
+BENCHMARK(BM_InterfaceDoublePointerTraits)->ThreadRange(1, 8);
+
+void BM_InterfaceGet(benchmark::State& state) {
+    auto plugin = Plugin();
+    utils::Interface<Foo> foo(plugin, "CreateFoo", "DestroyFoo", 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(foo.get());
+    }
+}
+BENCHMARK(BM_InterfaceGet)->ThreadRange(1, 8);
+
+// With a library name, get() checks the library is still loaded.
+void BM_InterfaceGetWellKnown(benchmark::State& state) {
+    auto plugin = Plugin();
+    utils::Interface<Foo> foo(plugin, "CreateFoo", "DestroyFoo", 1);
+    foo.SetLibraryName(PluginName());
+    if (!foo.get()) {
+        state.SkipWithError("the fixture plugin isn't found by name");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(foo.get());
+    }
+}
+BENCHMARK(BM_InterfaceGetWellKnown)->ThreadRange(1, 8);
+
+void BM_InterfaceArrow(benchmark::State& state) {
+    auto plugin = Plugin();
+    utils::Interface<Foo> foo(plugin, "CreateFoo", "DestroyFoo", 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(foo->value);
+    }
+}
+BENCHMARK(BM_InterfaceArrow);
+
+void BM_InterfaceWeakGet(benchmark::State& state) {
+    auto plugin = Plugin();
+    utils::Interface<Foo> foo(plugin, "CreateFoo", "DestroyFoo", 1);
+    auto weak = foo.AstWeakPtr();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(weak.get());
+    }
+}
+BENCHMARK(BM_InterfaceWeakGet);
+
+void BM_DirectCall(benchmark::State& state) {
+    auto add = Plugin()->GetFunctionPointer(kAdd);
+    int value = 0;
+    for (auto _ : state) {
+        value = add(value, 1);
+        benchmark::DoNotOptimize(value);
+    }
+}
+BENCHMARK(BM_DirectCall);
+
+void BM_FunctionCall(benchmark::State& state) {
+    utils::Function<int, int, int> add(Plugin(), kAdd);
+    int value = 0;
+    for (auto _ : state) {
+        value = add(value, 1);
+        benchmark::DoNotOptimize(value);
+    }
+}
+BENCHMARK(BM_FunctionCall);
+
+void BM_LazyFunctionCall(benchmark::State& state) {
+    utils::LazyFunction<int, int, int> add(Plugin(), kAdd);
+    int value = 0;
+    for (auto _ : state) {
+        value = add(value, 1);
+        benchmark::DoNotOptimize(value);
+    }
+}
+BENCHMARK(BM_LazyFunctionCall);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (argc > 1) {
+        std::string path = argv[1];
+        g_plugin_path.assign(path.begin(), path.end());
+    }
+    if (!utils::DynamicLibrary(g_plugin_path).is_valid()) {
+        fprintf(stderr, "can't load the fixture plugin\n");
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,34 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+// The plugin loaded by dynamic_library_benchmark.cc. Built as a shared
+// library, with fixture_plugin.def on Windows so that the ordinals are fixed.
+
+#if defined(_WIN32)
+#define FIXTURE_EXPORT extern "C" __declspec(dllexport)
+#define FIXTURE_CALL __stdcall
+#else
+#define FIXTURE_EXPORT extern "C" __attribute__((visibility("default")))
+#define FIXTURE_CALL
+#endif
+
+struct Foo {
+    int value;
+};
+
+FIXTURE_EXPORT Foo* FIXTURE_CALL CreateFoo(int value) { return new Foo{value}; }
+
+FIXTURE_EXPORT void FIXTURE_CALL DestroyFoo(Foo* foo) { delete foo; }
+
+FIXTURE_EXPORT void FIXTURE_CALL DestroyFooPointer(Foo** foo) {
+    delete *foo;
+    *foo = nullptr;
+}
+
+FIXTURE_EXPORT int FIXTURE_CALL Add(int a, int b) { return a + b; }
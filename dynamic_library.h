@@ -9,11 +9,178 @@
 #ifndef UTILS_DYNAMIC_LIBRARY_INCLUDE_H_
 #define UTILS_DYNAMIC_LIBRARY_INCLUDE_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
 #include <Windows.h>
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <link.h>
+#endif
+#endif
 
 #include "basictypes.h"
 
+#if !defined(UTILS_LIBRARY_CALL)
+#if defined(_WIN32)
+#define UTILS_LIBRARY_CALL WINAPI
+#else
+#define UTILS_LIBRARY_CALL
+#endif
+#endif
+
+#include "dynamic_library_plugin.h"
+
+namespace utils {
+
+// Where the module is unloaded once its DynamicLibrary goes away. Unloading
+// takes the loader lock and runs the module's teardown, the thread dropping
+// the last reference may not afford it.
+enum class UnloadPolicy {
+    // On the thread releasing the DynamicLibrary.
+    kImmediate,
+    // On a background thread, see internal::LibraryReaper and
+    // StopBackgroundUnloads().
+    kBackground,
+    // Kept mapped until FlushDeferredUnloads() at a quiesce point.
+    kDeferred,
+};
+
+struct LoadOptions {
+    // Binds the library's own imports on first call (RTLD_LAZY) instead of at
+    // load (RTLD_NOW), trading startup latency for later stalls. The Windows
+    // loader always binds them at load.
+    bool lazy_binding = false;
+    // Makes the library's symbols available to the libraries loaded after it
+    // (RTLD_GLOBAL) instead of keeping them local (RTLD_LOCAL). Windows has no
+    // such namespace.
+    bool global_symbols = false;
+    UnloadPolicy unload_policy = UnloadPolicy::kImmediate;
+    // Reads the file through in large sequential reads before loading it, so
+    // that the loader maps it from the file cache.
+    bool prefetch_file = false;
+    // Faults the code and read-only data of the image in once loaded, in a
+    // few large reads rather than page by page as they are first touched.
+    bool prefetch_image = false;
+    // Prefetches only the pages recorded into this file by
+    // DynamicLibrary::SavePageProfile() in a previous run, when it matches the
+    // image, instead of what prefetch_image would.
+    std::wstring page_profile;
+    // Binds the exports listed by the library's GetPluginManifest export once
+    // loaded, see DynamicLibrary::LoadManifest().
+    bool load_manifest = false;
+    // Breaks the load down into a LoadTrace, see DynamicLibrary::load_trace().
+    bool trace = false;
+};
+
+// Where the time of one load went, see LoadOptions::trace. Durations are in
+// nanoseconds.
+struct LoadTrace {
+    struct Module {
+        std::wstring path;
+        // When the loader had mapped it, since the load started. 0 where the
+        // platform doesn't tell.
+        uint64_t mapped_ns = 0;
+    };
+
+    std::wstring path;
+    bool loaded = false;
+    uint64_t total_ns = 0;
+    // Spent waiting for the loader lock held by other threads before the load
+    // could start, probed by taking it once.
+    uint64_t loader_lock_wait_ns = 0;
+    // Opening and mapping the module and its new dependencies, relocating
+    // them and binding their imports. Windows only, 0 elsewhere.
+    uint64_t map_ns = 0;
+    // Running the initializers of the modules mapped, TLS callbacks and
+    // DllMain. Windows only, 0 elsewhere.
+    uint64_t init_ns = 0;
+    // The modules this load mapped, the library itself included, in the
+    // loader's order on Windows and by address elsewhere. Empty when it was
+    // loaded already. Elsewhere than on Windows, the modules other threads
+    // load meanwhile are counted too.
+    std::vector<Module> modules;
+};
+
+// A latency distribution, copied out of an internal::LatencyHistogram. The
+// buckets have a relative width of 25%, as HDR histograms with two bits of
+// precision.
+struct LatencySnapshot {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    // The non-empty buckets in increasing order, as the highest value they
+    // hold in nanoseconds and how many values they hold.
+    std::vector<std::pair<uint64_t, uint64_t>> buckets;
+
+    // Returns the highest value of the bucket holding the |percentile| %th
+    // value, 0 when empty.
+    uint64_t Percentile(double percentile) const {
+        if (count == 0) return 0;
+        auto rank = static_cast<uint64_t>(percentile / 100 * count + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (const auto& bucket : buckets) {
+            seen += bucket.second;
+            if (seen >= rank) return std::min(bucket.first, max_ns);
+        }
+        return max_ns;
+    }
+};
+
+// What the DynamicLibrary objects counted, for one library or the whole
+// process. All zero unless built with UTILS_DYNAMIC_LIBRARY_STATS defined,
+// which must then be defined the same for every translation unit.
+struct LibraryStats {
+    // Loading the module, its initialization included.
+    LatencySnapshot load_time;
+    // Every lookup of an export, by name or ordinal.
+    uint64_t lookups = 0;
+    // The lookups answered by the symbol cache.
+    uint64_t cache_hits = 0;
+    // The lookups finding nothing.
+    uint64_t failed_lookups = 0;
+    // The lookups missing the cache, spent in the export index or the loader.
+    LatencySnapshot lookup_time;
+    // Interface::get() checks of the wellknown library. Process-wide only.
+    uint64_t liveness_checks = 0;
+    // Destroy exports resolved by NativeTraits. Process-wide only.
+    uint64_t destroy_resolutions = 0;
+    // Of the traced loads only, see LoadTrace.
+    LatencySnapshot init_time;
+    LatencySnapshot loader_lock_wait;
+    uint64_t dependency_loads = 0;
+
+    uint64_t cache_misses() const { return lookups - cache_hits; }
+};
+
+} // namespace utils
+
 
 // These code move from https://github.com/Bugzl/test.
 
@@ -46,12 +213,21 @@ char(&ArraySizeHelper(const T(&array)[N]))[N];
 
 #define arraysize(array) (sizeof(ArraySizeHelper(array)))
 
+#if defined(_WIN32)
 const wchar_t kSeparators[] = L"\\/";
+#else
+const wchar_t kSeparators[] = L"/";
+#endif
 const size_t kSeparatorsLength = arraysize(kSeparators);
 const wchar_t kCurrentDirectory[] = L".";
 
-std::wstring::size_type FindDriveLetter(
-    const std::wstring& path) {
+#if !defined(_WIN32)
+// No drive letters outside of Windows.
+inline std::wstring::size_type FindDriveLetter(const std::wstring&) {
+  return std::wstring::npos;
+}
+#else
+inline std::wstring::size_type FindDriveLetter(const std::wstring& path) {
   // This is dependent on an ASCII-based character set, but that's a
   // reasonable assumption.  iswalpha can be too inclusive here.
   if (path.length() >= 2 && path[1] == L':' &&
@@ -61,8 +237,9 @@ std::wstring::size_type FindDriveLetter(
   }
   return std::wstring::npos;
 }
+#endif
 
-bool IsSeparator(wchar_t character) {
+inline bool IsSeparator(wchar_t character) {
   for (size_t i = 0; i < kSeparatorsLength - 1; ++i) {
     if (character == kSeparators[i]) {
       return true;
@@ -71,7 +248,7 @@ bool IsSeparator(wchar_t character) {
   return false;
 }
 
-std::wstring StripTrailingSeparators(std::wstring path) {
+inline std::wstring StripTrailingSeparators(std::wstring path) {
   auto start = FindDriveLetter(path) + 2;
   std::wstring::size_type last_stripped = std::wstring::npos;
   for (std::wstring::size_type pos = path.length();
@@ -87,7 +264,8 @@ std::wstring StripTrailingSeparators(std::wstring path) {
   return path;
 }
 
-bool GetCurrentDirectory(std::wstring* dir) {
+#if defined(_WIN32)
+inline bool GetCurrentDirectory(std::wstring* dir) {
   wchar_t system_buffer[MAX_PATH] = {0};
   auto len = ::GetCurrentDirectory(MAX_PATH, system_buffer);
   if (len == 0 || len > MAX_PATH) return false;
@@ -96,12 +274,13 @@ bool GetCurrentDirectory(std::wstring* dir) {
   return true;
 }
 
-bool SetCurrentDirectory(const std::wstring& directory) {
+inline bool SetCurrentDirectory(const std::wstring& directory) {
   BOOL ret = ::SetCurrentDirectory(directory.c_str());
   return ret != 0;
 }
+#endif  // defined(_WIN32)
 
-std::wstring GetParent(std::wstring path) {
+inline std::wstring GetParent(std::wstring path) {
   path = StripTrailingSeparators(path);
 
   // The drive letter, if any, always needs to remain in the output.  If there
@@ -133,11 +312,35 @@ std::wstring GetParent(std::wstring path) {
   return path;
 }
 
+// The read size used to pull a library file into the file cache.
+const size_t kReadAheadSize = 1 << 20;
+
+// Page aligned addresses in a loaded image.
+struct ImageRange {
+  uintptr_t begin;
+  size_t size;
+};
+
+#if defined(_WIN32)
+
+typedef HMODULE NativeLibrary;
+typedef DWORD PlatformThreadId;
+
+inline PlatformThreadId CurrentThreadId() { return ::GetCurrentThreadId(); }
+
+// Resolves the export |name| of |module| as a |Function|, cast through the
+// generic function pointer so that compilers don't warn about the types.
+template<typename Function>
+Function GetProcAddressAs(HMODULE module, const char* name) {
+  return reinterpret_cast<Function>(
+      reinterpret_cast<void (*)()>(::GetProcAddress(module, name)));
+}
+
 typedef HMODULE(WINAPI* LoadLibraryFunction)(const wchar_t* file_name);
 
 // LoadLibrary() opens the file off disk.
-HMODULE LoadNativeLibraryHelper(const std::wstring& library_path,
-                                LoadLibraryFunction load_library_api) {
+inline HMODULE LoadNativeLibraryHelper(const std::wstring& library_path,
+                                       LoadLibraryFunction load_library_api) {
   // Switch the current directory to the library directory as the library
   // may have dependencies on DLLs in this directory.
   bool restore_directory = false;
@@ -155,140 +358,2461 @@ HMODULE LoadNativeLibraryHelper(const std::wstring& library_path,
   return module;
 }
 
-HMODULE LoadLibrary(const std::wstring& path,
-                                     std::string* error) {
-  return ::internal::LoadNativeLibraryHelper(path, ::LoadLibraryW);
+// The legacy helper above changes the process current directory, the loads
+// falling back to it are serialized.
+inline std::mutex& CurrentDirectoryLock() {
+  static std::mutex lock;
+  return lock;
+}
+
+// Returns true when LoadLibraryExW() understands the LOAD_LIBRARY_SEARCH_*
+// flags, that is Windows 8 or later, or Windows 7 with KB2533623.
+inline bool LibrarySearchFlagsSupported() {
+  static const bool supported = [] {
+    HMODULE kernel32 = ::GetModuleHandle(L"kernel32.dll");
+    return kernel32 != nullptr &&
+           ::GetProcAddress(kernel32, "AddDllDirectory") != nullptr;
+  }();
+  return supported;
+}
+
+// LOAD_LIBRARY_SEARCH_DLL_LOAD_DIR requires a fully qualified path.
+inline bool GetAbsolutePath(const std::wstring& path,
+                            std::wstring* absolute_path) {
+  DWORD len = ::GetFullPathNameW(path.c_str(), 0, nullptr, nullptr);
+  if (len == 0) return false;
+  std::wstring buffer(len, L'\0');
+  len = ::GetFullPathNameW(path.c_str(), len, &buffer[0], nullptr);
+  if (len == 0 || len >= buffer.size()) return false;
+  buffer.resize(len);
+  *absolute_path = buffer;
+  return true;
+}
+
+// Returns the key identifying the file at |path|: absolute, long names, '\\'
+// separated, lower case and without trailing separators, so that different
+// spellings of one library give the same key.
+inline std::wstring CanonicalLibraryPath(const std::wstring& path) {
+  std::wstring result;
+  if (!GetAbsolutePath(path, &result)) result = path;
+  DWORD len = ::GetLongPathNameW(result.c_str(), nullptr, 0);
+  if (len != 0) {
+    std::wstring long_path(len, L'\0');
+    len = ::GetLongPathNameW(result.c_str(), &long_path[0], len);
+    if (len != 0 && len < long_path.size()) {
+      long_path.resize(len);
+      result = long_path;
+    }
+  }
+  for (auto& character : result) {
+    if (IsSeparator(character)) character = kSeparators[0];
+  }
+  if (!result.empty()) {
+    ::CharLowerBuffW(&result[0], static_cast<DWORD>(result.size()));
+  }
+  return StripTrailingSeparators(result);
+}
+
+// Same as LoadNativeLibraryHelper() but leaves the current directory alone, the
+// library's dependencies are searched in its own directory first. Safe to call
+// from several threads at once. |absolute_path| must be fully qualified.
+inline HMODULE LoadNativeLibraryExHelper(const std::wstring& absolute_path,
+                                         DWORD* last_error) {
+  HMODULE module = ::LoadLibraryExW(
+      absolute_path.c_str(), nullptr,
+      LOAD_LIBRARY_SEARCH_DLL_LOAD_DIR | LOAD_LIBRARY_SEARCH_DEFAULT_DIRS);
+  *last_error = module ? ERROR_SUCCESS : ::GetLastError();
+  return module;
+}
+
+// Returns true when |path| names a file by its location rather than a module
+// for the loader to search.
+inline bool HasDirectory(const std::wstring& path) {
+  if (FindDriveLetter(path) != std::wstring::npos) return true;
+  return std::any_of(path.begin(), path.end(), IsSeparator);
+}
+
+// The options only matter to dlopen().
+inline HMODULE LoadLibrary(const std::wstring& path,
+                           const utils::LoadOptions&,
+                           std::string* error) {
+  // Resolved once, before anything may move the current directory.
+  std::wstring absolute_path;
+  DWORD last_error = ERROR_SUCCESS;
+  HMODULE module = nullptr;
+  if (!HasDirectory(path)) {
+    // A bare module name goes through the standard search order.
+    module = ::LoadLibraryExW(path.c_str(), nullptr, 0);
+    last_error = module ? ERROR_SUCCESS : ::GetLastError();
+  } else if (!GetAbsolutePath(path, &absolute_path)) {
+    last_error = ::GetLastError();
+  } else if (LibrarySearchFlagsSupported()) {
+    module = LoadNativeLibraryExHelper(absolute_path, &last_error);
+  } else {
+    // Only the systems without the LOAD_LIBRARY_SEARCH_* flags still switch
+    // the current directory, and all their loads come this way.
+    std::lock_guard<std::mutex> guard(CurrentDirectoryLock());
+    module = ::internal::LoadNativeLibraryHelper(absolute_path, ::LoadLibraryW);
+    last_error = module ? ERROR_SUCCESS : ::GetLastError();
+  }
+  if (module == nullptr && error != nullptr) {
+    *error = "LoadLibrary failed with error " + std::to_string(last_error);
+  }
+  return module;
 }
 
 
-void UnloadNativeLibrary(HMODULE library) {
+inline void UnloadNativeLibrary(HMODULE library) {
   if (library == nullptr) return;
   ::FreeLibrary(library);
 }
 
+// Returns the handle of the loaded |library_name| without taking a reference,
+// or nullptr.
+inline HMODULE GetWellKnownLibraryHandle(const std::wstring& library_name) {
+  if (library_name.empty()) return nullptr;
+  return ::GetModuleHandle(library_name.c_str());
+}
 
-// Returns the result whether |library_name| had been loaded.
-// It will be true if |library_name| is empty.
-bool WellKnownLibrary(const std::wstring& library_name) {
-  if (library_name.empty()) return false;
-  HMODULE wellknown_handler = ::GetModuleHandle(library_name.c_str());
-  return nullptr != wellknown_handler;
+// Returns the loaded |library_name| with a reference taken on it, to be
+// dropped by UnloadNativeLibrary(), or nullptr when it isn't loaded.
+inline HMODULE PinWellKnownLibrary(const std::wstring& library_name) {
+  if (library_name.empty()) return nullptr;
+  HMODULE module = nullptr;
+  if (!::GetModuleHandleExW(0, library_name.c_str(), &module)) return nullptr;
+  return module;
 }
 
 
-void* GetFunctionPointerFromNativeLibrary(HMODULE library,
+// See LdrRegisterDllNotification on MSDN, these are not in the public SDK
+// headers.
+const ULONG kLdrDllNotificationReasonLoaded = 1;
+const ULONG kLdrDllNotificationReasonUnloaded = 2;
+
+struct LdrUnicodeString {
+  USHORT Length;
+  USHORT MaximumLength;
+  PWSTR Buffer;
+};
+
+struct LdrDllNotificationData {
+  ULONG Flags;
+  const LdrUnicodeString* FullDllName;
+  const LdrUnicodeString* BaseDllName;
+  PVOID DllBase;
+  ULONG SizeOfImage;
+};
+
+typedef void(CALLBACK* LdrDllNotificationFunction)(
+    ULONG reason, const LdrDllNotificationData* data, PVOID context);
+typedef LONG(NTAPI* LdrRegisterDllNotificationFunction)(
+    ULONG flags, LdrDllNotificationFunction callback, PVOID context,
+    PVOID* cookie);
+typedef LONG(NTAPI* LdrUnregisterDllNotificationFunction)(PVOID cookie);
+
+// Counts the modules unloaded from this process. A positive WellKnownLibrary()
+// answer stays true until this generation moves, so it can be cached by the
+// callers. unloads() is 0 when the loader notification is unavailable, then
+// nothing may be cached.
+class LoaderGeneration {
+ public:
+  static LoaderGeneration* GetInstance() {
+    static LoaderGeneration instance;
+    return &instance;
+  }
+
+  uint64_t unloads() const { return unloads_.load(std::memory_order_acquire); }
+
+  // Called under the loader lock with each module loaded, so the load tracer
+  // shares this registration instead of leaking one of its own.
+  typedef void (*LoadObserver)(const LdrDllNotificationData* data);
+  void set_load_observer(LoadObserver observer) {
+    observer_.store(observer, std::memory_order_release);
+  }
+
+ private:
+  LoaderGeneration() {
+    HMODULE ntdll = ::GetModuleHandle(L"ntdll.dll");
+    if (ntdll == nullptr) return;
+    auto register_notification =
+        GetProcAddressAs<LdrRegisterDllNotificationFunction>(
+            ntdll, "LdrRegisterDllNotification");
+    if (register_notification == nullptr) return;
+    if (register_notification(0, &LoaderGeneration::OnNotification, this,
+                              &cookie_) != 0) {
+      cookie_ = nullptr;
+      return;
+    }
+    unloads_.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  // The callback lives in the module including this header, so it has to be
+  // unregistered before that module goes away.
+  ~LoaderGeneration() {
+    if (cookie_ == nullptr) return;
+    HMODULE ntdll = ::GetModuleHandle(L"ntdll.dll");
+    if (ntdll == nullptr) return;
+    auto unregister_notification =
+        GetProcAddressAs<LdrUnregisterDllNotificationFunction>(
+            ntdll, "LdrUnregisterDllNotification");
+    if (unregister_notification) unregister_notification(cookie_);
+  }
+
+  // Runs under the loader lock, do nothing more than bumping the counter or
+  // handing the load to the observer.
+  static void CALLBACK OnNotification(ULONG reason,
+                                      const LdrDllNotificationData* data,
+                                      PVOID context) {
+    auto self = static_cast<LoaderGeneration*>(context);
+    if (reason == kLdrDllNotificationReasonLoaded) {
+      auto observer = self->observer_.load(std::memory_order_acquire);
+      if (observer && data) observer(data);
+      return;
+    }
+    if (reason != kLdrDllNotificationReasonUnloaded) return;
+    self->unloads_.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  std::atomic<uint64_t> unloads_{0};
+  std::atomic<LoadObserver> observer_{nullptr};
+  PVOID cookie_ = nullptr;
+};
+
+inline void* GetFunctionPointerFromNativeLibrary(HMODULE library,
                                                            const char* name) {
   if (name == nullptr) return nullptr;
-  return ::GetProcAddress(library, name);
+  return reinterpret_cast<void*>(::GetProcAddress(library, name));
 }
 
-void* GetFunctionPointerFromNativeLibrary(HMODULE library, int id) {
+inline void* GetFunctionPointerFromNativeLibrary(HMODULE library, int id) {
   if (library == nullptr) return nullptr;
-  return ::GetProcAddress(library, MAKEINTRESOURCEA(id));
+  return reinterpret_cast<void*>(::GetProcAddress(library, MAKEINTRESOURCEA(id)));
 }
 
-void* GetFunctionPointerFromNativeLibrary(
-    const std::wstring& library_name, const char* name) {
-  if (name == nullptr) return nullptr;
-  HMODULE wellknown_handler = ::GetModuleHandle(library_name.c_str());
-  if (nullptr == wellknown_handler) return nullptr;
-  return GetFunctionPointerFromNativeLibrary(wellknown_handler, name);
+inline void ReadFileAhead(const std::wstring& path) {
+  HANDLE file = ::CreateFileW(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return;
+  std::vector<char> buffer(kReadAheadSize);
+  DWORD read = 0;
+  while (::ReadFile(file, buffer.data(), static_cast<DWORD>(buffer.size()),
+                    &read, nullptr) &&
+         read != 0) {
+  }
+  ::CloseHandle(file);
 }
 
-void* GetFunctionPointerFromNativeLibrary(
-    const std::wstring& library_name, int id) {
-  if (library_name.empty()) return nullptr;
-  HMODULE wellknown_handler = ::GetModuleHandle(library_name.c_str());
-  if (nullptr == wellknown_handler) return nullptr;
-  return GetFunctionPointerFromNativeLibrary(wellknown_handler, id);
+inline size_t PageSize() {
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwPageSize;
 }
 
-}  // namespace internal
+// Returns the sections of |library| holding code or read-only data.
+inline std::vector<ImageRange> ImageHotRanges(HMODULE library) {
+  std::vector<ImageRange> result;
+  auto base = reinterpret_cast<const BYTE*>(library);
+  if (base == nullptr) return result;
+  auto dos_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+  if (dos_header->e_magic != IMAGE_DOS_SIGNATURE) return result;
+  auto nt_headers =
+      reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dos_header->e_lfanew);
+  if (nt_headers->Signature != IMAGE_NT_SIGNATURE) return result;
+  auto section = IMAGE_FIRST_SECTION(nt_headers);
+  for (WORD i = 0; i < nt_headers->FileHeader.NumberOfSections; ++i, ++section) {
+    DWORD flags = section->Characteristics;
+    bool code = (flags & IMAGE_SCN_MEM_EXECUTE) != 0;
+    bool read_only = (flags & IMAGE_SCN_CNT_INITIALIZED_DATA) &&
+                     (flags & IMAGE_SCN_MEM_READ) && !(flags & IMAGE_SCN_MEM_WRITE);
+    if (!code && !read_only) continue;
+    result.push_back({reinterpret_cast<uintptr_t>(base) + section->VirtualAddress,
+                      section->Misc.VirtualSize});
+  }
+  return result;
+}
 
+// See PrefetchVirtualMemory on MSDN, Windows 8 and later.
+struct MemoryRangeEntry {
+  PVOID VirtualAddress;
+  SIZE_T NumberOfBytes;
+};
 
-namespace utils {
+typedef BOOL(WINAPI* PrefetchVirtualMemoryFunction)(HANDLE process,
+                                                    ULONG_PTR count,
+                                                    MemoryRangeEntry* ranges,
+                                                    ULONG flags);
 
-template<typename R, typename... P>
-struct FunctorTraits { using Type = R(WINAPI *)(P...); };
+// Has the memory manager read |ranges| in with large I/Os, without waiting.
+inline void PrefetchRanges(const std::vector<ImageRange>& ranges) {
+  static auto prefetch = reinterpret_cast<PrefetchVirtualMemoryFunction>(
+      GetFunctionPointerFromNativeLibrary(::GetModuleHandleW(L"kernel32.dll"),
+                                          "PrefetchVirtualMemory"));
+  if (prefetch == nullptr || ranges.empty()) return;
+  std::vector<MemoryRangeEntry> entries;
+  for (const auto& range : ranges) {
+    entries.push_back({reinterpret_cast<PVOID>(range.begin), range.size});
+  }
+  prefetch(::GetCurrentProcess(), entries.size(), entries.data(), 0);
+}
 
-class DynamicLibrary {
- public:
-    explicit DynamicLibrary() {}
-    explicit DynamicLibrary(const HMODULE& library) : library_(library) {}
-    explicit DynamicLibrary(const std::wstring& path)
-        : library_(internal::LoadLibrary(path, nullptr)) {}
-    explicit DynamicLibrary(LPCTSTR filename) : library_name_(filename) {}
-    virtual ~DynamicLibrary() { internal::UnloadNativeLibrary(library_); }
+// See QueryWorkingSetEx on MSDN, which kernel32 exports as
+// K32QueryWorkingSetEx since Windows 7.
+struct WorkingSetExInformation {
+  PVOID VirtualAddress;
+  ULONG_PTR VirtualAttributes;
+};
 
-    bool is_valid() const { return !!library_ || internal::WellKnownLibrary(library_name_); }
+typedef BOOL(WINAPI* QueryWorkingSetExFunction)(HANDLE process, PVOID buffer,
+                                                DWORD size);
 
-    // Only validate when this object hold the wellknown library's handler.
-    const std::wstring& library_name() const { return library_name_; }
+// Sets |resident| to whether each page of |range| is in the working set.
+inline bool ResidentPages(const ImageRange& range, size_t page_size,
+                          std::vector<bool>* resident) {
+  static auto query = reinterpret_cast<QueryWorkingSetExFunction>(
+      GetFunctionPointerFromNativeLibrary(::GetModuleHandleW(L"kernel32.dll"),
+                                          "K32QueryWorkingSetEx"));
+  if (query == nullptr) return false;
+  std::vector<WorkingSetExInformation> pages((range.size + page_size - 1) /
+                                             page_size);
+  for (size_t i = 0; i < pages.size(); ++i) {
+    pages[i].VirtualAddress = reinterpret_cast<PVOID>(range.begin + i * page_size);
+  }
+  if (!query(::GetCurrentProcess(), pages.data(),
+             static_cast<DWORD>(pages.size() * sizeof(pages[0])))) {
+    return false;
+  }
+  resident->resize(pages.size());
+  for (size_t i = 0; i < pages.size(); ++i) {
+    (*resident)[i] = (pages[i].VirtualAttributes & 1) != 0;
+  }
+  return true;
+}
 
-    void* GetFunctionPointer(const char* function_name) const {
-        if (!is_valid()) return nullptr;
-        if (library_name_.empty()) return internal::GetFunctionPointerFromNativeLibrary(library_, function_name);
-        return internal::GetFunctionPointerFromNativeLibrary(library_name_, function_name);
+#else  // defined(_WIN32)
+
+typedef void* NativeLibrary;
+typedef std::thread::id PlatformThreadId;
+
+inline PlatformThreadId CurrentThreadId() { return std::this_thread::get_id(); }
+
+// The POSIX calls take UTF-8 paths, wchar_t holds UTF-32 there.
+inline std::string WideToUTF8(const std::wstring& wide) {
+  std::string result;
+  result.reserve(wide.size());
+  for (wchar_t character : wide) {
+    auto code = static_cast<uint32_t>(character);
+    if (code < 0x80) {
+      result += static_cast<char>(code);
+    } else if (code < 0x800) {
+      result += static_cast<char>(0xC0 | (code >> 6));
+      result += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      result += static_cast<char>(0xE0 | (code >> 12));
+      result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      result += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      result += static_cast<char>(0xF0 | (code >> 18));
+      result += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+      result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      result += static_cast<char>(0x80 | (code & 0x3F));
     }
+  }
+  return result;
+}
 
-    void* GetFunctionPointer(int function_id) const {
-        if (!is_valid()) return nullptr;
-        if (library_name_.empty()) return internal::GetFunctionPointerFromNativeLibrary(library_, function_id);
-        return internal::GetFunctionPointerFromNativeLibrary(library_name_, function_id);
+inline std::wstring UTF8ToWide(const std::string& utf8) {
+  std::wstring result;
+  result.reserve(utf8.size());
+  for (size_t i = 0; i < utf8.size();) {
+    auto lead = static_cast<uint8_t>(utf8[i]);
+    size_t length = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+    uint32_t code = length == 1 ? lead : lead & (0x7F >> length);
+    for (size_t j = 1; j < length && i + j < utf8.size(); ++j) {
+      code = (code << 6) | (static_cast<uint8_t>(utf8[i + j]) & 0x3F);
     }
+    result += static_cast<wchar_t>(code);
+    i += length;
+  }
+  return result;
+}
 
-    template<typename R, typename... P>
-    typename FunctorTraits<R, P...>::Type GetFunctionPointer(const std::string& InterfaceName) const {
-        if (!is_valid() && InterfaceName.empty()) return nullptr;
-        using Type = FunctorTraits<R, P...>::Type;
-        return reinterpret_cast<Type>(DynamicLibrary::GetFunctionPointer(InterfaceName.c_str()));
+inline int DlopenMode(const utils::LoadOptions& options) {
+  int mode = options.lazy_binding ? RTLD_LAZY : RTLD_NOW;
+  mode |= options.global_symbols ? RTLD_GLOBAL : RTLD_LOCAL;
+  return mode;
+}
+
+// Returns the key identifying the file at |path|, with the symbolic links
+// resolved, so that different spellings of one library give the same key.
+inline std::wstring CanonicalLibraryPath(const std::wstring& path) {
+  char* resolved = ::realpath(WideToUTF8(path).c_str(), nullptr);
+  if (resolved == nullptr) return StripTrailingSeparators(path);
+  std::wstring result = UTF8ToWide(resolved);
+  ::free(resolved);
+  return StripTrailingSeparators(result);
+}
+
+// The dynamic linker finds the library's dependencies through its own
+// DT_RUNPATH, there is no directory to switch to and dlopen() is safe to call
+// from several threads at once.
+inline NativeLibrary LoadLibrary(const std::wstring& path,
+                                 const utils::LoadOptions& options,
+                                 std::string* error) {
+  NativeLibrary library =
+      ::dlopen(WideToUTF8(path).c_str(), DlopenMode(options));
+  if (library == nullptr && error != nullptr) {
+    const char* message = ::dlerror();
+    *error = message ? message : "dlopen failed";
+  }
+  return library;
+}
+
+inline void UnloadNativeLibrary(NativeLibrary library) {
+  if (library == nullptr) return;
+  ::dlclose(library);
+}
+
+// Returns the handle of the loaded |library_name| without taking a reference,
+// or nullptr, the same as ::GetModuleHandle() does.
+inline NativeLibrary GetWellKnownLibraryHandle(
+    const std::wstring& library_name) {
+  if (library_name.empty()) return nullptr;
+  NativeLibrary library =
+      ::dlopen(WideToUTF8(library_name).c_str(), RTLD_LAZY | RTLD_NOLOAD);
+  if (library != nullptr) ::dlclose(library);
+  return library;
+}
+
+// Returns the loaded |library_name| with a reference taken on it, to be
+// dropped by UnloadNativeLibrary(), or nullptr when it isn't loaded.
+inline NativeLibrary PinWellKnownLibrary(const std::wstring& library_name) {
+  if (library_name.empty()) return nullptr;
+  return ::dlopen(WideToUTF8(library_name).c_str(), RTLD_LAZY | RTLD_NOLOAD);
+}
+
+// The dynamic linker has no unload notification, unloads() stays 0 and the
+// wellknown libraries are checked every time.
+class LoaderGeneration {
+ public:
+  static LoaderGeneration* GetInstance() {
+    static LoaderGeneration instance;
+    return &instance;
+  }
+
+  uint64_t unloads() const { return 0; }
+};
+
+inline void* GetFunctionPointerFromNativeLibrary(NativeLibrary library,
+                                                 const char* name) {
+  if (library == nullptr || name == nullptr) return nullptr;
+  return ::dlsym(library, name);
+}
+
+// ELF has no ordinals.
+inline void* GetFunctionPointerFromNativeLibrary(NativeLibrary, int) {
+  return nullptr;
+}
+
+inline void ReadFileAhead(const std::wstring& path) {
+  int file = ::open(WideToUTF8(path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (file < 0) return;
+#if defined(POSIX_FADV_SEQUENTIAL)
+  ::posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  std::vector<char> buffer(kReadAheadSize);
+  while (::read(file, buffer.data(), buffer.size()) > 0) {
+  }
+  ::close(file);
+}
+
+inline size_t PageSize() {
+  return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+#if defined(__linux__)
+// Returns the read-only segments of |library|, its code among them.
+inline std::vector<ImageRange> ImageHotRanges(NativeLibrary library) {
+  std::vector<ImageRange> result;
+  struct link_map* map = nullptr;
+  if (library == nullptr || ::dlinfo(library, RTLD_DI_LINKMAP, &map) != 0 ||
+      map == nullptr) {
+    return result;
+  }
+  struct Search {
+    const struct link_map* map;
+    size_t page_size;
+    std::vector<ImageRange>* ranges;
+  } search = {map, PageSize(), &result};
+  ::dl_iterate_phdr(
+      [](struct dl_phdr_info* info, size_t, void* data) -> int {
+        auto search = static_cast<Search*>(data);
+        if (info->dlpi_addr != search->map->l_addr ||
+            std::strcmp(info->dlpi_name, search->map->l_name) != 0) {
+          return 0;
+        }
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+          const auto& header = info->dlpi_phdr[i];
+          if (header.p_type != PT_LOAD || (header.p_flags & PF_W)) continue;
+          uintptr_t begin = info->dlpi_addr + header.p_vaddr;
+          uintptr_t end = begin + header.p_memsz;
+          begin &= ~static_cast<uintptr_t>(search->page_size - 1);
+          search->ranges->push_back({begin, end - begin});
+        }
+        return 1;
+      },
+      &search);
+  return result;
+}
+
+inline void PrefetchRanges(const std::vector<ImageRange>& ranges) {
+  for (const auto& range : ranges) {
+    ::madvise(reinterpret_cast<void*>(range.begin), range.size, MADV_WILLNEED);
+  }
+}
+
+// Sets |resident| to whether each page of |range| is mapped into this
+// process, as /proc/self/pagemap tells: the pages this process faulted in,
+// along with the neighbours the kernel maps around each fault. Without
+// pagemap, mincore() tells which pages are in the page cache instead, those
+// touched by any process mapping the file, a residency snapshot rather than
+// what this process used.
+inline bool ResidentPages(const ImageRange& range, size_t page_size,
+                          std::vector<bool>* resident) {
+  size_t count = (range.size + page_size - 1) / page_size;
+  int pagemap = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (pagemap >= 0) {
+    std::vector<uint64_t> entries(count);
+    auto size = static_cast<ssize_t>(count * sizeof(entries[0]));
+    auto offset =
+        static_cast<off_t>(range.begin / page_size * sizeof(entries[0]));
+    bool read = ::pread(pagemap, entries.data(), size, offset) == size;
+    ::close(pagemap);
+    if (read) {
+      resident->resize(count);
+      // Bit 63 is set for the pages present in memory.
+      for (size_t i = 0; i < count; ++i) {
+        (*resident)[i] = (entries[i] >> 63) != 0;
+      }
+      return true;
     }
+  }
+  std::vector<unsigned char> pages(count);
+  if (::mincore(reinterpret_cast<void*>(range.begin), range.size,
+                pages.data()) != 0) {
+    return false;
+  }
+  resident->resize(pages.size());
+  for (size_t i = 0; i < pages.size(); ++i) (*resident)[i] = pages[i] & 1;
+  return true;
+}
+#else  // defined(__linux__)
+// Finding the segments of a library takes dlinfo(), which not every dynamic
+// linker has.
+inline std::vector<ImageRange> ImageHotRanges(NativeLibrary) {
+  return std::vector<ImageRange>();
+}
 
-    template<typename R, typename... P>
-    typename FunctorTraits<R, P...>::Type GetFunctionPointer(int InterfaceID) const {
-        if (!is_valid()) return nullptr;
-        using Type = FunctorTraits<R, P...>::Type;
-        return reinterpret_cast<Type>(DynamicLibrary::GetFunctionPointer(InterfaceID));
+inline void PrefetchRanges(const std::vector<ImageRange>&) {}
+
+inline bool ResidentPages(const ImageRange&, size_t, std::vector<bool>*) {
+  return false;
+}
+#endif  // defined(__linux__)
+
+#endif  // defined(_WIN32)
+
+inline NativeLibrary LoadLibrary(const std::wstring& path, std::string* error) {
+  return LoadLibrary(path, utils::LoadOptions(), error);
+}
+
+// The pages of the hot ranges of an image found in memory by a previous run,
+// as runs of bytes from the lowest range. The header tells which image it was
+// taken from, roughly: a profile of another build only prefetches the wrong
+// pages of the right library.
+struct PageProfileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t page_size;
+  uint64_t span;
+  uint64_t run_count;
+};
+
+const uint32_t kPageProfileMagic = 0x50504c44;  // "DLPP"
+const uint32_t kPageProfileVersion = 1;
+
+// Returns the lowest address of |ranges| and sets |span| to the sum of their
+// sizes.
+inline uintptr_t ImageRangesOrigin(const std::vector<ImageRange>& ranges,
+                                   uint64_t* span) {
+  uintptr_t origin = UINTPTR_MAX;
+  *span = 0;
+  for (const auto& range : ranges) {
+    origin = std::min(origin, range.begin);
+    *span += range.size;
+  }
+  return origin;
+}
+
+inline bool SavePageProfile(NativeLibrary library, const std::wstring& path) {
+  auto ranges = ImageHotRanges(library);
+  if (ranges.empty()) return false;
+  size_t page_size = PageSize();
+  uint64_t span = 0;
+  uintptr_t origin = ImageRangesOrigin(ranges, &span);
+  std::vector<std::pair<uint64_t, uint64_t>> runs;
+  for (const auto& range : ranges) {
+    std::vector<bool> resident;
+    if (!ResidentPages(range, page_size, &resident)) return false;
+    for (size_t i = 0; i < resident.size(); ++i) {
+      if (!resident[i]) continue;
+      uint64_t offset = range.begin - origin + i * page_size;
+      if (!runs.empty() && runs.back().first + runs.back().second == offset) {
+        runs.back().second += page_size;
+      } else {
+        runs.emplace_back(offset, page_size);
+      }
     }
+  }
+  std::ofstream file(std::filesystem::path(path),
+                     std::ios::binary | std::ios::trunc);
+  if (!file) return false;
+  PageProfileHeader header = {kPageProfileMagic, kPageProfileVersion, page_size,
+                              span, runs.size()};
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(runs.data()),
+             runs.size() * sizeof(runs[0]));
+  return !!file;
+}
 
-    void Reset(HMODULE library) {
-        internal::UnloadNativeLibrary(library_);
-        library_ = library;
+inline bool ReplayPageProfile(NativeLibrary library, const std::wstring& path) {
+  auto ranges = ImageHotRanges(library);
+  if (ranges.empty()) return false;
+  std::ifstream file(std::filesystem::path(path), std::ios::binary);
+  if (!file) return false;
+  uint64_t span = 0;
+  uintptr_t origin = ImageRangesOrigin(ranges, &span);
+  PageProfileHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != kPageProfileMagic ||
+      header.version != kPageProfileVersion ||
+      header.page_size != PageSize() || header.span != span) {
+    return false;
+  }
+  uintptr_t end = 0;
+  for (const auto& range : ranges) end = std::max(end, range.begin + range.size);
+  std::vector<ImageRange> pages;
+  std::pair<uint64_t, uint64_t> run;
+  for (uint64_t i = 0; i < header.run_count; ++i) {
+    if (!file.read(reinterpret_cast<char*>(&run), sizeof(run))) return false;
+    if (run.first >= end - origin) continue;
+    auto size = std::min<uint64_t>(run.second, end - origin - run.first);
+    pages.push_back({origin + static_cast<uintptr_t>(run.first),
+                     static_cast<size_t>(size)});
+  }
+  PrefetchRanges(pages);
+  return true;
+}
+
+// The prefetching asked for by |options| once |library| is loaded.
+inline void PrefetchImage(NativeLibrary library,
+                          const utils::LoadOptions& options) {
+  if (!options.page_profile.empty() &&
+      ReplayPageProfile(library, options.page_profile)) {
+    return;
+  }
+  if (options.prefetch_image) PrefetchRanges(ImageHotRanges(library));
+}
+
+// Returns a small number, distinct for each thread alive, to spread the state
+// updated by every thread over a few shards.
+inline size_t ThreadSlot() {
+  static std::atomic<size_t> next_slot{0};
+  thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+  return slot;
+}
+
+#if defined(UTILS_DYNAMIC_LIBRARY_STATS)
+const bool kStatsEnabled = true;
+#else
+const bool kStatsEnabled = false;
+#endif
+
+// Nanoseconds on a monotonic clock, 0 without stats so that nothing reads the
+// clock.
+inline uint64_t StatsNow() {
+  if (!kStatsEnabled) return 0;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A counter bumped from any thread without contention: every thread adds to
+// its own cache line, value() sums them.
+class StatsCounter {
+ public:
+  void Add(uint64_t delta = 1) {
+    shards_[ThreadSlot() % kShards].value.fetch_add(delta,
+                                                    std::memory_order_relaxed);
+  }
+
+  uint64_t value() const {
+    uint64_t result = 0;
+    for (const auto& shard : shards_)
+      result += shard.value.load(std::memory_order_relaxed);
+    return result;
+  }
+
+ private:
+  static const size_t kShards = 16;
+
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value{0};
+  };
+
+  Shard shards_[kShards];
+};
+
+// Counts values in buckets growing by powers of two, each split in
+// 2^kSubBucketBits linear sub-buckets, the way HDR histograms do. Recording
+// costs a few relaxed atomic adds, it is meant for the slow paths.
+class LatencyHistogram {
+ public:
+  void Record(uint64_t value) {
+    counts_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max &&
+           !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
     }
+  }
 
-    // Returns the native library handle and removes it from this object. The
-    // caller must manage the lifetime of the handle.
-    // Otherwise, when we hold the wellknown library's handler, result should be nullptr.
-    auto Release() {
-        auto result = library_;
-        library_ = nullptr;
-        return result;
+  utils::LatencySnapshot Snapshot() const {
+    utils::LatencySnapshot result;
+    for (size_t i = 0; i < kBuckets; ++i) {
+      uint64_t count = counts_[i].load(std::memory_order_relaxed);
+      if (count == 0) continue;
+      result.count += count;
+      result.buckets.emplace_back(HighestValueOf(i), count);
     }
+    result.total_ns = total_.load(std::memory_order_relaxed);
+    result.max_ns = max_.load(std::memory_order_relaxed);
+    return result;
+  }
 
-private:
-    std::wstring library_name_;
-    HMODULE library_ = nullptr;
-    DISALLOW_COPY_AND_ASSIGN(DynamicLibrary);
+ private:
+  static const int kSubBucketBits = 2;
+  static const size_t kSubBuckets = 1 << kSubBucketBits;
+  static const size_t kBuckets = (65 - kSubBucketBits) << kSubBucketBits;
+
+  static int Log2(uint64_t value) {
+    int result = 0;
+    for (int shift = 32; shift != 0; shift >>= 1) {
+      if (value >> shift) {
+        value >>= shift;
+        result += shift;
+      }
+    }
+    return result;
+  }
+
+  static size_t BucketOf(uint64_t value) {
+    if (value < kSubBuckets) return static_cast<size_t>(value);
+    int exponent = Log2(value);
+    size_t sub_bucket = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+    return ((exponent - kSubBucketBits + 1) << kSubBucketBits) | sub_bucket;
+  }
+
+  static uint64_t HighestValueOf(size_t bucket) {
+    if (bucket < kSubBuckets) return bucket;
+    int exponent = static_cast<int>(bucket >> kSubBucketBits) + kSubBucketBits - 1;
+    int shift = exponent - kSubBucketBits;
+    uint64_t lowest = static_cast<uint64_t>(kSubBuckets | (bucket & (kSubBuckets - 1))) << shift;
+    return lowest + ((uint64_t(1) << shift) - 1);
+  }
+
+  std::atomic<uint64_t> counts_[kBuckets] = {};
+  std::atomic<uint64_t> total_{0};
+  std::atomic<uint64_t> max_{0};
 };
 
-template<typename R, typename... P>
-typename FunctorTraits<R, P...>::Type GetFunctionPointer(const HMODULE& library, const std::string& InterfaceName) {
-    if (!library || InterfaceName.empty()) return nullptr;
-    using Type = FunctorTraits<R, P...>::Type;
-    return reinterpret_cast<Type>(GetFunctionPointerFromNativeLibrary(library, InterfaceName.c_str()));
+// The counters behind utils::LibraryStats. Every DynamicLibrary has its own
+// when stats are enabled, and adds to the process-wide ones as well.
+struct LibraryCounters {
+  LatencyHistogram load_time;
+  StatsCounter lookups;
+  StatsCounter cache_hits;
+  StatsCounter failed_lookups;
+  LatencyHistogram lookup_time;
+  StatsCounter liveness_checks;
+  StatsCounter destroy_resolutions;
+  LatencyHistogram init_time;
+  LatencyHistogram loader_lock_wait;
+  StatsCounter dependency_loads;
+
+  // nullptr without stats.
+  static std::unique_ptr<LibraryCounters> Create() {
+    if (!kStatsEnabled) return nullptr;
+    return std::unique_ptr<LibraryCounters>(new LibraryCounters);
+  }
+
+  // Leaky, for the libraries going away during the process teardown.
+  static LibraryCounters* Process() {
+    if (!kStatsEnabled) return nullptr;
+    static LibraryCounters* counters = new LibraryCounters;
+    return counters;
+  }
+
+  utils::LibraryStats Snapshot() const {
+    utils::LibraryStats result;
+    result.load_time = load_time.Snapshot();
+    result.lookups = lookups.value();
+    result.cache_hits = cache_hits.value();
+    result.failed_lookups = failed_lookups.value();
+    result.lookup_time = lookup_time.Snapshot();
+    result.liveness_checks = liveness_checks.value();
+    result.destroy_resolutions = destroy_resolutions.value();
+    result.init_time = init_time.Snapshot();
+    result.loader_lock_wait = loader_lock_wait.Snapshot();
+    result.dependency_loads = dependency_loads.value();
+    return result;
+  }
+};
+
+// Records a load started at |start|, see StatsNow().
+inline void RecordLoad(LibraryCounters* counters, uint64_t start) {
+  if (!kStatsEnabled) return;
+  uint64_t elapsed = StatsNow() - start;
+  for (auto target : {counters, LibraryCounters::Process()}) {
+    if (target) target->load_time.Record(elapsed);
+  }
 }
 
-template<typename R, typename... P>
-typename FunctorTraits<R, P...>::Type GetFunctionPointer(const DynamicLibrary* library, const std::string& InterfaceName) {
-    if (!library) return nullptr;
-    return library->GetFunctionPointer<R, P...>(InterfaceName.c_str());
+// Records a lookup answered by the symbol cache, or one which missed it at
+// |start|.
+inline void RecordLookup(LibraryCounters* counters, bool cached, uint64_t start,
+                         bool found) {
+  if (!kStatsEnabled) return;
+  uint64_t elapsed = cached ? 0 : StatsNow() - start;
+  for (auto target : {counters, LibraryCounters::Process()}) {
+    if (!target) continue;
+    target->lookups.Add();
+    if (cached) target->cache_hits.Add();
+    else target->lookup_time.Record(elapsed);
+    if (!found) target->failed_lookups.Add();
+  }
 }
 
-template<typename R, typename... P>
-typename FunctorTraits<R, P...>::Type GetFunctionPointer(const std::weak_ptr<DynamicLibrary>& library, const std::string& InterfaceName) {
-    auto known_library = library.lock();
-    if (!known_library) return nullptr;
-    return known_library->GetFunctionPointer<R, P...>(InterfaceName.c_str());
+inline void RecordLivenessCheck() {
+  if (kStatsEnabled) LibraryCounters::Process()->liveness_checks.Add();
+}
+
+inline void RecordDestroyResolution() {
+  if (kStatsEnabled) LibraryCounters::Process()->destroy_resolutions.Add();
+}
+
+inline void RecordLoadTrace(LibraryCounters* counters,
+                            const utils::LoadTrace& trace) {
+  if (!kStatsEnabled || !trace.loaded) return;
+  for (auto target : {counters, LibraryCounters::Process()}) {
+    if (!target) continue;
+    target->init_time.Record(trace.init_ns);
+    target->loader_lock_wait.Record(trace.loader_lock_wait_ns);
+    if (trace.modules.size() > 1)
+      target->dependency_loads.Add(trace.modules.size() - 1);
+  }
+}
+
+// Nanoseconds on a monotonic clock, whether stats are enabled or not.
+inline uint64_t TraceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Loads libraries the way LoadLibrary() does, filling a utils::LoadTrace, and
+// keeps the latest traces. Windows is told of every module mapped by the
+// loader's notifications, sent on the loading thread before the module's
+// initializers run. Elsewhere the loaded objects are listed before and after.
+class LoadTracer {
+ public:
+  static const size_t kKeptTraces = 64;
+
+  static LoadTracer* GetInstance() {
+    static LoadTracer* instance = new LoadTracer();
+    return instance;
+  }
+
+  NativeLibrary Load(const std::wstring& path,
+                     const utils::LoadOptions& options,
+                     utils::LoadTrace* trace) {
+    *trace = utils::LoadTrace();
+    trace->path = path;
+    // What the session sets up before the load isn't timed.
+    Session session(trace);
+    uint64_t start = TraceNow();
+    session.Start(start);
+    trace->loader_lock_wait_ns = ProbeLoaderLock(&session);
+    NativeLibrary library = LoadLibrary(path, options, nullptr);
+    uint64_t end = TraceNow();
+    session.Finish(end);
+    trace->loaded = library != nullptr;
+    trace->total_ns = end - start;
+    Keep(*trace);
+    return library;
+  }
+
+  // The latest kKeptTraces traces, oldest first.
+  std::vector<utils::LoadTrace> Traces() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return std::vector<utils::LoadTrace>(traces_.begin(), traces_.end());
+  }
+
+ private:
+  LoadTracer() {}
+
+  void Keep(const utils::LoadTrace& trace) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (traces_.size() == kKeptTraces) traces_.pop_front();
+    traces_.push_back(trace);
+  }
+
+#if defined(_WIN32)
+  typedef LONG(NTAPI* LockLoaderLockFunction)(ULONG flags, ULONG* disposition,
+                                              void** cookie);
+  typedef LONG(NTAPI* UnlockLoaderLockFunction)(ULONG flags, void* cookie);
+
+  // The load traced on this thread.
+  class Session {
+   public:
+    explicit Session(utils::LoadTrace* trace)
+        : trace_(trace), start_(0), mapped_(0), previous_(current()) {
+      Register();
+      current() = this;
+    }
+    ~Session() { current() = previous_; }
+
+    void Start(uint64_t start) { start_ = mapped_ = start; }
+
+    void Started(uint64_t now) { mapped_ = now; }
+
+    void Finish(uint64_t end) {
+      current() = previous_;
+      if (trace_->modules.empty()) return;
+      trace_->map_ns = mapped_ - start_ - trace_->loader_lock_wait_ns;
+      trace_->init_ns = end - mapped_;
+    }
+
+   private:
+    static Session*& current() {
+      thread_local Session* session = nullptr;
+      return session;
+    }
+
+    static void OnLoaded(const LdrDllNotificationData* data) {
+      Session* session = current();
+      if (!session) return;
+      utils::LoadTrace::Module module;
+      if (data->FullDllName && data->FullDllName->Buffer)
+        module.path.assign(data->FullDllName->Buffer,
+                           data->FullDllName->Length / sizeof(wchar_t));
+      session->mapped_ = TraceNow();
+      module.mapped_ns = session->mapped_ - session->start_;
+      session->trace_->modules.push_back(module);
+    }
+
+    // Shares LoaderGeneration's notification, which is unregistered with
+    // this module.
+    static void Register() {
+      LoaderGeneration::GetInstance()->set_load_observer(&Session::OnLoaded);
+    }
+
+    utils::LoadTrace* trace_;
+    uint64_t start_;
+    // When the last module was mapped, its initializers run after.
+    uint64_t mapped_;
+    // The load this one is nested in, from a DllMain.
+    Session* previous_;
+  };
+
+  static uint64_t ProbeLoaderLock(Session* session) {
+    static const auto functions = [] {
+      HMODULE ntdll = ::GetModuleHandle(L"ntdll.dll");
+      LockLoaderLockFunction lock = nullptr;
+      UnlockLoaderLockFunction unlock = nullptr;
+      if (ntdll != nullptr) {
+        lock = GetProcAddressAs<LockLoaderLockFunction>(ntdll,
+                                                        "LdrLockLoaderLock");
+        unlock = GetProcAddressAs<UnlockLoaderLockFunction>(
+            ntdll, "LdrUnlockLoaderLock");
+      }
+      return std::make_pair(lock, unlock);
+    }();
+    if (!functions.first || !functions.second) return 0;
+    uint64_t start = TraceNow();
+    ULONG disposition = 0;
+    void* cookie = nullptr;
+    if (functions.first(0, &disposition, &cookie) < 0) return 0;
+    uint64_t now = TraceNow();
+    functions.second(0, cookie);
+    session->Started(now);
+    return now - start;
+  }
+#else
+  struct LoadedObject {
+    uintptr_t base;
+    std::string name;
+
+    bool operator<(const LoadedObject& r) const {
+      return base != r.base ? base < r.base : name < r.name;
+    }
+  };
+
+  // Lists the loaded objects apart from the executable, sorted.
+  static std::vector<LoadedObject> LoadedObjects() {
+    std::vector<LoadedObject> result;
+#if defined(__linux__)
+    ::dl_iterate_phdr(
+        [](struct dl_phdr_info* info, size_t, void* data) {
+          if (info->dlpi_name && info->dlpi_name[0] != '\0') {
+            static_cast<std::vector<LoadedObject>*>(data)->push_back(
+                LoadedObject{info->dlpi_addr, info->dlpi_name});
+          }
+          return 0;
+        },
+        &result);
+#endif
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  class Session {
+   public:
+    // Lists the objects loaded already.
+    explicit Session(utils::LoadTrace* trace)
+        : trace_(trace), before_(LoadedObjects()) {}
+
+    void Start(uint64_t) {}
+
+    void Finish(uint64_t) {
+      auto after = LoadedObjects();
+      std::vector<LoadedObject> mapped;
+      std::set_difference(after.begin(), after.end(), before_.begin(),
+                          before_.end(), std::back_inserter(mapped));
+      for (const auto& object : mapped) {
+        utils::LoadTrace::Module module;
+        module.path = UTF8ToWide(object.name);
+        trace_->modules.push_back(module);
+      }
+    }
+
+   private:
+    utils::LoadTrace* trace_;
+    std::vector<LoadedObject> before_;
+  };
+
+  // dl_iterate_phdr() takes the lock dlopen() holds while adding objects, a
+  // callback stopping at the first object makes it no more than that. The
+  // objects are listed once before, by the Session, and once after the load:
+  // any object other threads load in between is counted as one this load
+  // mapped.
+  static uint64_t ProbeLoaderLock(Session*) {
+    uint64_t start = TraceNow();
+#if defined(__linux__)
+    ::dl_iterate_phdr([](struct dl_phdr_info*, size_t, void*) { return 1; },
+                      nullptr);
+#endif
+    return TraceNow() - start;
+  }
+#endif  // defined(_WIN32)
+
+  mutable std::mutex lock_;
+  std::deque<utils::LoadTrace> traces_;
+  DISALLOW_COPY_AND_ASSIGN(LoadTracer);
+};
+
+// Unloads the modules handed over by the DynamicLibrary objects not unloading
+// on their own thread, see utils::UnloadPolicy. The background thread runs
+// the code of the module including this header: a module that may be
+// unloaded while the process goes on has to Stop() it first.
+class LibraryReaper {
+ public:
+  // Leaked along with its thread, the modules still queued at exit go with
+  // the process.
+  static LibraryReaper* GetInstance() {
+    static LibraryReaper* instance = new LibraryReaper();
+    return instance;
+  }
+
+  void Unload(NativeLibrary library, utils::UnloadPolicy policy) {
+    if (library == nullptr) return;
+    if (policy == utils::UnloadPolicy::kImmediate) {
+      UnloadNativeLibrary(library);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (policy == utils::UnloadPolicy::kDeferred) {
+        deferred_.push_back(library);
+        return;
+      }
+      if (!stopped_) {
+        background_.push_back(library);
+        if (!thread_.joinable()) thread_ = std::thread([this] { Run(); });
+        library = nullptr;
+      }
+    }
+    // Stopped, the releasing thread unloads it.
+    if (library) UnloadNativeLibrary(library);
+    else wakeup_.notify_one();
+  }
+
+  // Joins the background thread once it has unloaded the modules queued,
+  // the modules released with UnloadPolicy::kBackground later are unloaded
+  // on the releasing thread. Not from DllMain, where the thread can't exit.
+  void Stop() {
+    std::thread thread;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      stopped_ = true;
+      thread.swap(thread_);
+    }
+    wakeup_.notify_one();
+    if (thread.joinable()) thread.join();
+  }
+
+  // Unloads the deferred modules on the calling thread, in the order they
+  // were released. Returns how many were unloaded.
+  size_t FlushDeferred() {
+    std::vector<NativeLibrary> libraries;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      libraries.swap(deferred_);
+    }
+    for (auto library : libraries) UnloadNativeLibrary(library);
+    return libraries.size();
+  }
+
+ private:
+  LibraryReaper() {}
+
+  void Run() {
+    for (;;) {
+      std::vector<NativeLibrary> libraries;
+      {
+        std::unique_lock<std::mutex> guard(lock_);
+        wakeup_.wait(guard,
+                     [this] { return !background_.empty() || stopped_; });
+        if (background_.empty()) return;
+        libraries.swap(background_);
+      }
+      for (auto library : libraries) UnloadNativeLibrary(library);
+    }
+  }
+
+  std::mutex lock_;
+  std::condition_variable wakeup_;
+  std::vector<NativeLibrary> background_;
+  std::vector<NativeLibrary> deferred_;
+  std::thread thread_;
+  bool stopped_ = false;
+  DISALLOW_COPY_AND_ASSIGN(LibraryReaper);
+};
+
+// Returns the result whether |library_name| had been loaded.
+// It will be true if |library_name| is empty.
+inline bool WellKnownLibrary(const std::wstring& library_name) {
+  return nullptr != GetWellKnownLibraryHandle(library_name);
+}
+
+// Remembers the loader generation at which |library_name| was last seen
+// loaded, so that a repeated check costs two atomic loads while no module has
+// been unloaded since. Only positive answers are cached.
+class WellKnownLibraryCache {
+ public:
+  WellKnownLibraryCache() {}
+  WellKnownLibraryCache(const WellKnownLibraryCache& r)
+      : generation_(r.generation_.load(std::memory_order_relaxed)) {}
+  WellKnownLibraryCache& operator=(const WellKnownLibraryCache& r) {
+    generation_.store(r.generation_.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+    return *this;
+  }
+
+  bool IsLoaded(const std::wstring& library_name) const {
+    // Read the generation before asking the loader, an unload racing with
+    // ::GetModuleHandle then moves it past the value we store.
+    auto generation = LoaderGeneration::GetInstance()->unloads();
+    if (generation != 0 &&
+        generation == generation_.load(std::memory_order_acquire)) {
+      return true;
+    }
+    if (!WellKnownLibrary(library_name)) return false;
+    generation_.store(generation, std::memory_order_release);
+    return true;
+  }
+
+  void Invalidate() { generation_.store(0, std::memory_order_relaxed); }
+
+  void swap(WellKnownLibraryCache& r) {
+    auto generation = generation_.load(std::memory_order_relaxed);
+    generation_.store(r.generation_.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+    r.generation_.store(generation, std::memory_order_relaxed);
+  }
+
+ private:
+  mutable std::atomic<uint64_t> generation_{0};
+};
+
+// Small integers standing for the wellknown library names for the rest of the
+// process, 0 for none. Handles naming a library copy an id rather than a
+// string, and the liveness of each library is cached once, for all of them.
+typedef uint32_t ModuleId;
+const ModuleId kNoModule = 0;
+
+class ModuleNames {
+ public:
+  // Leaked, the handles may check a library during static destruction.
+  static ModuleNames* GetInstance() {
+    static ModuleNames* instance = new ModuleNames();
+    return instance;
+  }
+
+  ModuleId Intern(const std::wstring& name) {
+    if (name.empty()) return kNoModule;
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = ids_.find(name);
+    if (it != ids_.end()) return it->second;
+    // Four million names, a process naming more is broken.
+    if (count_ == kChunkSize * kMaxChunks) std::terminate();
+    auto& slot = chunks_[count_ / kChunkSize];
+    Chunk* chunk = slot.load(std::memory_order_relaxed);
+    if (!chunk) {
+      chunk = new Chunk;
+      slot.store(chunk, std::memory_order_release);
+    }
+    chunk->entries[count_ % kChunkSize].name = name;
+    ModuleId id = static_cast<ModuleId>(++count_);
+    ids_.emplace(name, id);
+    return id;
+  }
+
+  // Lock-free, |id| must come from Intern().
+  const std::wstring& Name(ModuleId id) const {
+    static const std::wstring* none = new std::wstring();
+    if (id == kNoModule) return *none;
+    return At(id).name;
+  }
+
+  bool IsLoaded(ModuleId id) const {
+    if (id == kNoModule) return false;
+    const auto& entry = At(id);
+    return entry.liveness.IsLoaded(entry.name);
+  }
+
+ private:
+  static const size_t kChunkSize = 1024;
+  static const size_t kMaxChunks = 4096;
+
+  struct Entry {
+    std::wstring name;
+    WellKnownLibraryCache liveness;
+  };
+
+  struct Chunk {
+    Entry entries[kChunkSize];
+  };
+
+  ModuleNames() {}
+
+  // The id was handed out after its entry was written, by a thread which
+  // synchronized with ours to pass it, the chunk is visible.
+  const Entry& At(ModuleId id) const {
+    size_t index = id - 1;
+    return chunks_[index / kChunkSize].load(std::memory_order_acquire)
+        ->entries[index % kChunkSize];
+  }
+
+  std::mutex lock_;
+  std::unordered_map<std::wstring, ModuleId> ids_;
+  size_t count_ = 0;
+  std::atomic<Chunk*> chunks_[kMaxChunks] = {};
+  DISALLOW_COPY_AND_ASSIGN(ModuleNames);
+};
+
+
+inline void* GetFunctionPointerFromNativeLibrary(
+    const std::wstring& library_name, const char* name) {
+  if (name == nullptr) return nullptr;
+  NativeLibrary wellknown_handler = GetWellKnownLibraryHandle(library_name);
+  if (nullptr == wellknown_handler) return nullptr;
+  return GetFunctionPointerFromNativeLibrary(wellknown_handler, name);
+}
+
+inline void* GetFunctionPointerFromNativeLibrary(
+    const std::wstring& library_name, int id) {
+  if (library_name.empty()) return nullptr;
+  NativeLibrary wellknown_handler = GetWellKnownLibraryHandle(library_name);
+  if (nullptr == wellknown_handler) return nullptr;
+  return GetFunctionPointerFromNativeLibrary(wellknown_handler, id);
+}
+
+
+#if defined(_WIN32)
+// Reads the export directory of a module mapped as an image in this process.
+// The names are sorted, see the PE format, which lets callers binary search
+// them.
+class ExportDirectory {
+ public:
+  explicit ExportDirectory(HMODULE module) {
+    auto base = reinterpret_cast<const BYTE*>(module);
+    if (base == nullptr) return;
+    auto dos_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+    if (dos_header->e_magic != IMAGE_DOS_SIGNATURE) return;
+    auto nt_headers =
+        reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dos_header->e_lfanew);
+    if (nt_headers->Signature != IMAGE_NT_SIGNATURE) return;
+    const auto& entry =
+        nt_headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+    if (entry.VirtualAddress == 0 || entry.Size == 0) return;
+
+    module_ = module;
+    base_ = base;
+    nt_headers_ = nt_headers;
+    begin_ = entry.VirtualAddress;
+    end_ = entry.VirtualAddress + entry.Size;
+    directory_ =
+        reinterpret_cast<const IMAGE_EXPORT_DIRECTORY*>(base + begin_);
+    names_ = reinterpret_cast<const DWORD*>(base + directory_->AddressOfNames);
+    name_ordinals_ =
+        reinterpret_cast<const WORD*>(base + directory_->AddressOfNameOrdinals);
+    functions_ =
+        reinterpret_cast<const DWORD*>(base + directory_->AddressOfFunctions);
+  }
+
+  bool is_valid() const { return directory_ != nullptr; }
+
+  // Identify one build of the module, along with name_count().
+  DWORD time_date_stamp() const { return nt_headers_->FileHeader.TimeDateStamp; }
+  DWORD checksum() const { return nt_headers_->OptionalHeader.CheckSum; }
+  DWORD size_of_image() const { return nt_headers_->OptionalHeader.SizeOfImage; }
+
+  DWORD name_count() const { return is_valid() ? directory_->NumberOfNames : 0; }
+
+  const char* NameAt(DWORD index) const {
+    return reinterpret_cast<const char*>(base_ + names_[index]);
+  }
+
+  // Sets |index| to where |name| is in the names, searched from |first| on.
+  bool FindName(const char* name, DWORD first, DWORD* index) const {
+    DWORD last = name_count();
+    while (first < last) {
+      DWORD middle = first + (last - first) / 2;
+      int compare = std::strcmp(NameAt(middle), name);
+      if (compare == 0) {
+        *index = middle;
+        return true;
+      }
+      if (compare < 0) first = middle + 1;
+      else last = middle;
+    }
+    return false;
+  }
+
+  DWORD OrdinalAt(DWORD index) const {
+    return directory_->Base + name_ordinals_[index];
+  }
+
+  // Returns the address exported as NameAt(|index|).
+  void* FunctionAt(DWORD index) const {
+    return FunctionAtSlot(name_ordinals_[index]);
+  }
+
+  // Returns the address exported as |ordinal|, indexing the export address
+  // table directly.
+  void* FunctionByOrdinal(DWORD ordinal) const {
+    if (!is_valid() || ordinal < directory_->Base) return nullptr;
+    return FunctionAtSlot(ordinal - directory_->Base);
+  }
+
+ private:
+  void* FunctionAtSlot(DWORD slot) const {
+    if (slot >= directory_->NumberOfFunctions) return nullptr;
+    DWORD rva = functions_[slot];
+    if (rva == 0) return nullptr;
+    // Forwarded exports point back into the export directory at a
+    // "library.name" string, the loader knows how to follow them.
+    if (rva >= begin_ && rva < end_) {
+      return GetFunctionPointerFromNativeLibrary(
+          module_, static_cast<int>(directory_->Base + slot));
+    }
+    return const_cast<BYTE*>(base_ + rva);
+  }
+
+  HMODULE module_ = nullptr;
+  const BYTE* base_ = nullptr;
+  const IMAGE_NT_HEADERS* nt_headers_ = nullptr;
+  DWORD begin_ = 0;
+  DWORD end_ = 0;
+  const IMAGE_EXPORT_DIRECTORY* directory_ = nullptr;
+  const DWORD* names_ = nullptr;
+  const WORD* name_ordinals_ = nullptr;
+  const DWORD* functions_ = nullptr;
+};
+#endif  // defined(_WIN32)
+
+// FNV-1a of a symbol name, constexpr so that literals can be hashed at
+// compile time.
+constexpr uint64_t HashSymbolName(const char* name) {
+  uint64_t hash = 14695981039346656037ull;
+  for (; *name != '\0'; ++name) {
+    hash ^= static_cast<uint8_t>(*name);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// The symbols resolved from one module, keyed by name or ordinal and filled on
+// first lookup. Every entry is tagged with the generation of the mapping it was
+// resolved from, a lookup with another generation misses and the first insert
+// of a newer generation drops the older entries. Generation 0 stands for a
+// mapping that may go away unnoticed, such as a wellknown library nothing
+// pins, and is never cached.
+class SymbolCache {
+ public:
+  SymbolCache() {}
+
+  // |signature| is set to the one the entry was inserted with, when given.
+  bool Find(const char* name, uint64_t hash, uint64_t generation,
+            void** address, uint64_t* signature = nullptr) const {
+    std::shared_lock<std::shared_mutex> guard(lock_);
+    if (generation == 0 || generation != generation_) return false;
+    auto range = names_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.name != name) continue;
+      *address = it->second.address;
+      if (signature) *signature = it->second.signature;
+      return true;
+    }
+    return false;
+  }
+
+  bool Find(int id, uint64_t generation, void** address) const {
+    std::shared_lock<std::shared_mutex> guard(lock_);
+    if (generation == 0 || generation != generation_) return false;
+    auto it = ordinals_.find(id);
+    if (it == ordinals_.end()) return false;
+    *address = it->second;
+    return true;
+  }
+
+  // A |signature| other than 0, one of internal::SignatureOf(), replaces the
+  // entry already there.
+  void Insert(const char* name, uint64_t hash, uint64_t generation,
+              void* address, uint64_t signature = 0) {
+    std::unique_lock<std::shared_mutex> guard(lock_);
+    if (!Advance(generation)) return;
+    auto range = names_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.name != name) continue;
+      if (signature != 0) it->second = Entry{name, address, signature};
+      return;
+    }
+    names_.emplace(hash, Entry{name, address, signature});
+  }
+
+  void Insert(int id, uint64_t generation, void* address) {
+    std::unique_lock<std::shared_mutex> guard(lock_);
+    if (!Advance(generation)) return;
+    ordinals_.emplace(id, address);
+  }
+
+  // Also forgets the generation, the next insert starts any.
+  void Clear() {
+    std::unique_lock<std::shared_mutex> guard(lock_);
+    names_.clear();
+    ordinals_.clear();
+    generation_ = 0;
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    void* address;
+    uint64_t signature;
+  };
+
+  // Returns false when |generation| is 0 or older than the cached entries.
+  bool Advance(uint64_t generation) {
+    if (generation == 0 || generation < generation_) return false;
+    if (generation == generation_) return true;
+    names_.clear();
+    ordinals_.clear();
+    generation_ = generation;
+    return true;
+  }
+
+  mutable std::shared_mutex lock_;
+  uint64_t generation_ = 0;
+  std::unordered_multimap<uint64_t, Entry> names_;
+  std::unordered_map<int, void*> ordinals_;
+  DISALLOW_COPY_AND_ASSIGN(SymbolCache);
+};
+
+
+#if defined(_WIN32)
+// A minimal perfect hash over the export names of one module, so that a lookup
+// is one hash and a single string compare instead of GetProcAddress' binary
+// search. Built with hash and displace: the names are spread over buckets and,
+// largest bucket first, a seed is searched which sends all of a bucket's names
+// to free slots.
+//
+// Built on first use, and kept in |cache_path| across runs when given, keyed
+// by the module's timestamp, checksum, image size and name count.
+class ExportIndex {
+ public:
+  explicit ExportIndex(const std::wstring& cache_path)
+      : cache_path_(cache_path) {}
+
+  const std::wstring& cache_path() const { return cache_path_; }
+
+  // Returns true and sets |address| when |name| is exported by |module|.
+  // False means the index can't tell, the caller then asks the loader.
+  bool Find(HMODULE module, const char* name, uint64_t hash,
+            void** address) {
+    if (!EnsureBuilt(module)) return false;
+    size_t bucket = hash % seeds_.size();
+    DWORD index = slots_[Mix(hash, seeds_[bucket]) % slots_.size()];
+    if (std::strcmp(exports_.NameAt(index), name) != 0) return false;
+    *address = exports_.FunctionAt(index);
+    return true;
+  }
+
+ private:
+  enum State { kNotBuilt, kBuilt, kFailed };
+
+  static const DWORD kMagic = 0x58494c44;  // "DLIX"
+  static const DWORD kVersion = 1;
+  static const DWORD kNamesPerBucket = 4;
+  static const uint32_t kMaxSeed = 1 << 20;
+
+  struct Key {
+    DWORD magic;
+    DWORD version;
+    DWORD time_date_stamp;
+    DWORD checksum;
+    DWORD size_of_image;
+    DWORD name_count;
+    DWORD bucket_count;
+  };
+
+  static uint64_t Mix(uint64_t hash, uint32_t seed) {
+    hash ^= seed * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+  }
+
+  static Key MakeKey(const ExportDirectory& exports) {
+    Key key = {kMagic, kVersion, exports.time_date_stamp(), exports.checksum(),
+               exports.size_of_image(), exports.name_count(), 0};
+    key.bucket_count = key.name_count / kNamesPerBucket + 1;
+    return key;
+  }
+
+  bool EnsureBuilt(HMODULE module) {
+    int state = state_.load(std::memory_order_acquire);
+    if (state != kNotBuilt) return state == kBuilt;
+    std::lock_guard<std::mutex> guard(lock_);
+    state = state_.load(std::memory_order_relaxed);
+    if (state != kNotBuilt) return state == kBuilt;
+
+    ExportDirectory exports(module);
+    bool built = false;
+    if (exports.is_valid() && exports.name_count() != 0) {
+      built = Load(exports);
+      if (!built && Build(exports)) {
+        built = true;
+        Save(exports);
+      }
+    }
+    exports_ = exports;
+    state_.store(built ? kBuilt : kFailed, std::memory_order_release);
+    return built;
+  }
+
+  bool Build(const ExportDirectory& exports) {
+    Key key = MakeKey(exports);
+    std::vector<uint64_t> hashes(key.name_count);
+    std::vector<std::vector<DWORD>> buckets(key.bucket_count);
+    for (DWORD i = 0; i < key.name_count; ++i) {
+      hashes[i] = HashSymbolName(exports.NameAt(i));
+      buckets[hashes[i] % key.bucket_count].push_back(i);
+    }
+    std::vector<uint32_t> order(key.bucket_count);
+    for (uint32_t i = 0; i < key.bucket_count; ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<uint32_t> seeds(key.bucket_count, 0);
+    std::vector<DWORD> slots(key.name_count, 0);
+    std::vector<bool> taken(key.name_count, false);
+    std::vector<size_t> placed;
+    for (auto bucket : order) {
+      const auto& names = buckets[bucket];
+      if (names.empty()) break;
+      uint32_t seed = 0;
+      for (; seed < kMaxSeed; ++seed) {
+        placed.clear();
+        for (auto name : names) {
+          size_t slot = Mix(hashes[name], seed) % key.name_count;
+          if (taken[slot] ||
+              std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+            break;
+          }
+          placed.push_back(slot);
+        }
+        if (placed.size() == names.size()) break;
+      }
+      // Names with the same hash can't be told apart.
+      if (seed == kMaxSeed) return false;
+      seeds[bucket] = seed;
+      for (size_t i = 0; i < names.size(); ++i) {
+        taken[placed[i]] = true;
+        slots[placed[i]] = names[i];
+      }
+    }
+    seeds_.swap(seeds);
+    slots_.swap(slots);
+    return true;
+  }
+
+  bool Load(const ExportDirectory& exports) {
+    if (cache_path_.empty()) return false;
+    std::ifstream file(std::filesystem::path(cache_path_), std::ios::binary);
+    if (!file) return false;
+    Key expected = MakeKey(exports);
+    Key key;
+    if (!file.read(reinterpret_cast<char*>(&key), sizeof(key)) ||
+        std::memcmp(&key, &expected, sizeof(key)) != 0) {
+      return false;
+    }
+    std::vector<uint32_t> seeds(key.bucket_count);
+    std::vector<DWORD> slots(key.name_count);
+    if (!file.read(reinterpret_cast<char*>(seeds.data()),
+                   seeds.size() * sizeof(seeds[0])) ||
+        !file.read(reinterpret_cast<char*>(slots.data()),
+                   slots.size() * sizeof(slots[0]))) {
+      return false;
+    }
+    for (auto slot : slots) {
+      if (slot >= key.name_count) return false;
+    }
+    seeds_.swap(seeds);
+    slots_.swap(slots);
+    return true;
+  }
+
+  bool Save(const ExportDirectory& exports) const {
+    if (cache_path_.empty()) return false;
+    std::ofstream file(std::filesystem::path(cache_path_),
+                       std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+    Key key = MakeKey(exports);
+    file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    file.write(reinterpret_cast<const char*>(seeds_.data()),
+               seeds_.size() * sizeof(seeds_[0]));
+    file.write(reinterpret_cast<const char*>(slots_.data()),
+               slots_.size() * sizeof(slots_[0]));
+    return !!file;
+  }
+
+  const std::wstring cache_path_;
+  std::mutex lock_;
+  std::atomic<int> state_{kNotBuilt};
+  ExportDirectory exports_{nullptr};
+  std::vector<uint32_t> seeds_;
+  std::vector<DWORD> slots_;
+};
+
+// Maps the export names of one build of a module to their ordinals, so that
+// binding is a lookup of the name's hash in the map followed by an index into
+// the export address table, rather than GetProcAddress' search of the names.
+// The map is read from |path|, which a plugin may ship, as the line
+//
+//   DLORD 1 <TimeDateStamp> <CheckSum> <SizeOfImage>
+//
+// identifying the build, followed by one "<name> <ordinal>" line per export,
+// numbers in hex. A map for another build is ignored, and |cache_path| is
+// read instead; failing that too, one is computed from the export directory on
+// first use and saved to |cache_path|. The shipped |path| is never written.
+// Names the map doesn't know are looked up by the caller, and so are all of
+// them when the map can be neither read nor computed.
+class OrdinalMap {
+ public:
+  OrdinalMap(const std::wstring& path, const std::wstring& cache_path)
+      : path_(path), cache_path_(cache_path) {}
+
+  const std::wstring& path() const { return path_; }
+
+  const std::wstring& cache_path() const { return cache_path_; }
+
+  // Returns true and sets |address| when |name| is exported by |module|.
+  bool Find(HMODULE module, const char* name, uint64_t hash,
+            void** address) {
+    if (!EnsureLoaded(module)) return false;
+    auto range = ordinals_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.name != name) continue;
+      *address = exports_.FunctionByOrdinal(it->second.ordinal);
+      return *address != nullptr;
+    }
+    return false;
+  }
+
+ private:
+  enum State { kNotLoaded, kLoaded, kFailed };
+
+  static const DWORD kVersion = 1;
+
+  struct Entry {
+    std::string name;
+    DWORD ordinal;
+  };
+
+  bool EnsureLoaded(HMODULE module) {
+    int state = state_.load(std::memory_order_acquire);
+    if (state != kNotLoaded) return state == kLoaded;
+    std::lock_guard<std::mutex> guard(lock_);
+    state = state_.load(std::memory_order_relaxed);
+    if (state != kNotLoaded) return state == kLoaded;
+
+    ExportDirectory exports(module);
+    bool loaded = false;
+    if (exports.is_valid()) {
+      loaded = Load(path_, exports) || Load(cache_path_, exports);
+      if (!loaded && exports.name_count() != 0) {
+        Build(exports);
+        Save(cache_path_, exports);
+        loaded = true;
+      }
+    }
+    exports_ = exports;
+    state_.store(loaded ? kLoaded : kFailed, std::memory_order_release);
+    return loaded;
+  }
+
+  void Build(const ExportDirectory& exports) {
+    ordinals_.clear();
+    ordinals_.reserve(exports.name_count());
+    for (DWORD i = 0; i < exports.name_count(); ++i) {
+      const char* name = exports.NameAt(i);
+      ordinals_.emplace(HashSymbolName(name), Entry{name, exports.OrdinalAt(i)});
+    }
+  }
+
+  bool Load(const std::wstring& path, const ExportDirectory& exports) {
+    if (path.empty()) return false;
+    std::ifstream file(std::filesystem::path(path), std::ios::in);
+    if (!file) return false;
+    std::string magic;
+    DWORD version = 0, time_date_stamp = 0, checksum = 0, size_of_image = 0;
+    file >> magic >> std::hex >> version >> time_date_stamp >> checksum >>
+        size_of_image;
+    if (!file || magic != "DLORD" || version != kVersion ||
+        time_date_stamp != exports.time_date_stamp() ||
+        checksum != exports.checksum() ||
+        size_of_image != exports.size_of_image()) {
+      return false;
+    }
+    std::unordered_multimap<uint64_t, Entry> ordinals;
+    Entry entry;
+    while (file >> entry.name >> entry.ordinal) {
+      uint64_t hash = HashSymbolName(entry.name.c_str());
+      ordinals.emplace(hash, std::move(entry));
+    }
+    if (!file.eof()) return false;
+    ordinals_.swap(ordinals);
+    return true;
+  }
+
+  bool Save(const std::wstring& path, const ExportDirectory& exports) const {
+    if (path.empty()) return false;
+    std::ofstream file(std::filesystem::path(path), std::ios::trunc);
+    if (!file) return false;
+    file << "DLORD " << std::hex << kVersion << ' '
+         << exports.time_date_stamp() << ' ' << exports.checksum() << ' '
+         << exports.size_of_image() << '\n';
+    for (DWORD i = 0; i < exports.name_count(); ++i)
+      file << exports.NameAt(i) << ' ' << exports.OrdinalAt(i) << '\n';
+    return !!file;
+  }
+
+  const std::wstring path_;
+  const std::wstring cache_path_;
+  std::mutex lock_;
+  std::atomic<int> state_{kNotLoaded};
+  ExportDirectory exports_{nullptr};
+  std::unordered_multimap<uint64_t, Entry> ordinals_;
+};
+#else  // defined(_WIN32)
+// The dynamic linker already looks ELF symbols up through their GNU hash
+// table, there is nothing to index.
+class ExportIndex {
+ public:
+  explicit ExportIndex(const std::wstring& cache_path)
+      : cache_path_(cache_path) {}
+
+  const std::wstring& cache_path() const { return cache_path_; }
+
+  bool Find(NativeLibrary, const char*, uint64_t, void**) { return false; }
+
+ private:
+  const std::wstring cache_path_;
+};
+
+// ELF has no ordinals.
+class OrdinalMap {
+ public:
+  OrdinalMap(const std::wstring& path, const std::wstring& cache_path)
+      : path_(path), cache_path_(cache_path) {}
+
+  const std::wstring& path() const { return path_; }
+
+  const std::wstring& cache_path() const { return cache_path_; }
+
+  bool Find(NativeLibrary, const char*, uint64_t, void**) { return false; }
+
+ private:
+  const std::wstring path_;
+  const std::wstring cache_path_;
+};
+#endif  // defined(_WIN32)
+
+}  // namespace internal
+
+
+namespace utils {
+
+template<typename R, typename... P>
+struct FunctorTraits { using Type = R(UTILS_LIBRARY_CALL *)(P...); };
+
+// Names an export along with the signature it is called with. Declared
+// constexpr, the name is hashed at compile time and looking it up allocates
+// nothing, while calling it with the wrong signature doesn't compile.
+//
+//   constexpr utils::Symbol<Foo*, int> kCreateFoo("CreateFoo");
+//   auto create = library->GetFunctionPointer(kCreateFoo);
+//
+// Only meant for string literals, the name is not copied.
+template<typename R, typename... P>
+class Symbol {
+public:
+    using Type = typename FunctorTraits<R, P...>::Type;
+
+    // Names nothing, resolves to nullptr.
+    constexpr Symbol() : name_(nullptr), length_(0), hash_(0) {}
+    template<size_t N>
+    constexpr explicit Symbol(const char (&name)[N])
+        : name_(name)
+        , length_(N - 1)
+        , hash_(internal::HashSymbolName(name)) {}
+
+    constexpr const char* name() const { return name_; }
+    constexpr size_t length() const { return length_; }
+    constexpr uint64_t hash() const { return hash_; }
+    // Checked against the plugin manifest's, see DynamicLibrary::LoadManifest().
+    static constexpr uint64_t signature() { return internal::SignatureOf<R, P...>(); }
+
+private:
+    const char* name_;
+    size_t length_;
+    uint64_t hash_;
+};
+
+class DynamicLibrary {
+ public:
+    explicit DynamicLibrary() {}
+    explicit DynamicLibrary(const internal::NativeLibrary& library) : library_(library) {}
+    // A |path| with a directory loads that file. On Windows its dependencies
+    // are then searched in its own directory, the application's and the
+    // system's, but neither in the current directory nor the PATH, unless the
+    // system predates the LOAD_LIBRARY_SEARCH_* flags. A bare module name goes
+    // through the loader's standard search order.
+    explicit DynamicLibrary(const std::wstring& path) {
+        auto start = internal::StatsNow();
+        library_ = internal::LoadLibrary(path, nullptr);
+        if (library_) internal::RecordLoad(counters_.get(), start);
+    }
+    explicit DynamicLibrary(const std::wstring& path, const LoadOptions& options)
+        : unload_policy_(options.unload_policy) {
+        auto start = internal::StatsNow();
+        if (options.prefetch_file) internal::ReadFileAhead(path);
+        if (options.trace) {
+            load_trace_.reset(new LoadTrace);
+            library_ = internal::LoadTracer::GetInstance()->Load(path, options, load_trace_.get());
+            internal::RecordLoadTrace(counters_.get(), *load_trace_);
+        } else {
+            library_ = internal::LoadLibrary(path, options, nullptr);
+        }
+        if (!library_) return;
+        internal::PrefetchImage(library_, options);
+        if (options.load_manifest) LoadManifest();
+        internal::RecordLoad(counters_.get(), start);
+    }
+#if defined(_WIN32)
+    explicit DynamicLibrary(LPCTSTR filename)
+        : library_id_(internal::ModuleNames::GetInstance()->Intern(filename)) {}
+#else
+    explicit DynamicLibrary(const wchar_t* filename)
+        : library_id_(internal::ModuleNames::GetInstance()->Intern(filename)) {}
+#endif
+    virtual ~DynamicLibrary() {
+        internal::LibraryReaper::GetInstance()->Unload(library_, unload_policy_);
+        internal::LibraryReaper::GetInstance()->Unload(pinned_.load(), unload_policy_);
+    }
+
+    using Future = std::shared_future<std::shared_ptr<DynamicLibrary>>;
+    // Runs the task it is given, later and on another thread.
+    using Executor = std::function<void(std::function<void()>)>;
+    using LoadCallback = std::function<void(const std::shared_ptr<DynamicLibrary>&)>;
+
+    // Loads |path| through the LibraryRegistry on |executor|, or on a thread
+    // of its own without one, then resolves |exports| into the symbol cache.
+    // |options| apply only when this request is the one loading the library.
+    // The future, and |callback| run on the loading thread, get nullptr when
+    // the library or one of |exports| can't be loaded, or when |executor|
+    // throws or drops the task unrun. Requests for a path already being
+    // loaded wait for that load rather than starting another. A library
+    // already loaded completes the request before returning, on the calling
+    // thread, without a task.
+    static Future LoadAsync(const std::wstring& path, const Executor& executor = Executor(),
+                            const std::vector<std::string>& exports = std::vector<std::string>(),
+                            const LoadCallback& callback = LoadCallback(),
+                            const LoadOptions& options = LoadOptions());
+
+    bool is_valid() const { return !!library_ || !!pinned_library(); }
+
+    // Only validate when this object hold the wellknown library's handler.
+    const std::wstring& library_name() const { return internal::ModuleNames::GetInstance()->Name(library_id_); }
+
+    // The interned library_name(), kNoModule for the libraries we own.
+    internal::ModuleId library_id() const { return library_id_; }
+
+    // Returns the wellknown library's name held by |library|, or empty.
+    static std::wstring GetLibraryName(const std::shared_ptr<DynamicLibrary>& library) {
+        if (!library) return std::wstring();
+        return library->library_name();
+    }
+
+    static internal::ModuleId GetLibraryId(const std::shared_ptr<DynamicLibrary>& library) {
+        if (!library) return internal::kNoModule;
+        return library->library_id();
+    }
+
+    void* GetFunctionPointer(const char* function_name) const {
+        if (function_name == nullptr) return nullptr;
+        return FindFunctionPointer(function_name, internal::HashSymbolName(function_name));
+    }
+
+    void* GetFunctionPointer(int function_id) const {
+        auto generation = symbols_generation();
+        void* address = nullptr;
+        if (symbols_.Find(function_id, generation, &address)) {
+            internal::RecordLookup(counters_.get(), true, 0, address != nullptr);
+            return address;
+        }
+        if (!is_valid()) return nullptr;
+        auto start = internal::StatsNow();
+        if (!is_wellknown()) address = internal::GetFunctionPointerFromNativeLibrary(library_, function_id);
+        else address = internal::GetFunctionPointerFromNativeLibrary(pinned_library(), function_id);
+        symbols_.Insert(function_id, generation, address);
+        internal::RecordLookup(counters_.get(), false, start, address != nullptr);
+        return address;
+    }
+
+    template<typename R, typename... P>
+    typename FunctorTraits<R, P...>::Type GetFunctionPointer(const std::string& InterfaceName) const {
+        if (InterfaceName.empty()) return nullptr;
+        using Type = typename FunctorTraits<R, P...>::Type;
+        return reinterpret_cast<Type>(FindFunctionPointer(InterfaceName.c_str(), internal::HashSymbolName(InterfaceName.c_str()),
+                                                          internal::SignatureOf<R, P...>()));
+    }
+
+    template<typename R, typename... P>
+    typename FunctorTraits<R, P...>::Type GetFunctionPointer(int InterfaceID) const {
+        using Type = typename FunctorTraits<R, P...>::Type;
+        return reinterpret_cast<Type>(DynamicLibrary::GetFunctionPointer(InterfaceID));
+    }
+
+    template<typename R, typename... P>
+    typename Symbol<R, P...>::Type GetFunctionPointer(const Symbol<R, P...>& symbol) const {
+        using Type = typename Symbol<R, P...>::Type;
+        if (symbol.name() == nullptr) return nullptr;
+        return reinterpret_cast<Type>(FindFunctionPointer(symbol.name(), symbol.hash(), symbol.signature()));
+    }
+
+    // Records |address| as the export |function_name|, for the callers
+    // resolving exports in bulk.
+    void CacheFunctionPointer(const char* function_name, void* address) const {
+        if (function_name == nullptr) return;
+        symbols_.Insert(function_name, internal::HashSymbolName(function_name), symbols_generation(), address);
+    }
+
+    // Binds every export listed by the library's GetPluginManifest export, see
+    // dynamic_library_plugin.h, in one call rather than one lookup each. The
+    // bindings are kept apart from the symbol cache, so that they outlive its
+    // invalidation, and are looked up before it: those asked for later with a
+    // typed GetFunctionPointer() or a Symbol resolve to nullptr when both
+    // sides know the signature and it differs. Reset() binds the new
+    // library's manifest. Returns false when the library has no manifest, one
+    // of another ABI version or one binding nothing.
+    bool LoadManifest() {
+        auto function = reinterpret_cast<GetPluginManifestFunction>(GetFunctionPointer(kPluginManifestExport));
+        if (!function) return false;
+        auto manifest = function();
+        if (!manifest || manifest->abi_version != kPluginAbiVersion) return false;
+        size_t bound = 0;
+        for (uint32_t i = 0; i < manifest->count; ++i) {
+            const auto& entry = manifest->exports[i];
+            if (entry.name == nullptr || entry.function == nullptr) continue;
+            manifest_.Insert(entry.name, internal::HashSymbolName(entry.name), kManifestGeneration,
+                             entry.function, entry.signature);
+            ++bound;
+        }
+        if (bound == 0) return false;
+        has_manifest_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Returns the module this object resolves from, without taking a
+    // reference on it.
+    internal::NativeLibrary native_library() const {
+        if (!is_wellknown()) return library_;
+        return pinned_library();
+    }
+
+    // Looks the exports missing the symbol cache up through a perfect hash
+    // over the export names, built on first use, rather than GetProcAddress'
+    // binary search. Meant for libraries with very many exports. The index is
+    // kept in |cache_path| across runs when given. Replaces the ordinal
+    // binding, both answer the same lookups. Safe while other threads look
+    // exports up. Windows only, and not for the wellknown library.
+    void EnableExportIndex(const std::wstring& cache_path = std::wstring()) {
+        if (is_wellknown()) return;
+        std::lock_guard<std::mutex> guard(lookups_lock_);
+        PublishLookup(&ordinal_map_, static_cast<internal::OrdinalMap*>(nullptr));
+        PublishLookup(&export_index_, new internal::ExportIndex(cache_path));
+    }
+
+    // Binds the exports by ordinal: the name is looked up by its hash in the
+    // name to ordinal map kept in |map_path| for this build of the library,
+    // see internal::OrdinalMap, which gives the index into the export address
+    // table. A map for another build is computed instead and kept in
+    // |cache_path| across runs when given, |map_path| is left as shipped.
+    // Names missing from the map, or all of them when it can't be computed,
+    // are looked up as usual. Replaces the export index. Safe while other
+    // threads look exports up. Windows only, and not for the wellknown
+    // library.
+    void EnableOrdinalBinding(const std::wstring& map_path = std::wstring(),
+                              const std::wstring& cache_path = std::wstring()) {
+        if (is_wellknown()) return;
+        std::lock_guard<std::mutex> guard(lookups_lock_);
+        PublishLookup(&export_index_, static_cast<internal::ExportIndex*>(nullptr));
+        PublishLookup(&ordinal_map_, new internal::OrdinalMap(map_path, cache_path));
+    }
+
+    // Records which pages of the library's code and read-only data are in
+    // memory into |path|, for LoadOptions::page_profile to prefetch them in
+    // the next runs. Meant to be called once the startup is over. Windows
+    // records the working set of this process. Linux records the pages
+    // mapped into it, along with the neighbours of each fault, and falls back
+    // to page cache residency, which also counts what other processes
+    // touched, when /proc/self/pagemap can't be read.
+    bool SavePageProfile(const std::wstring& path) const {
+        return internal::SavePageProfile(native_library(), path);
+    }
+
+    // What this library counted, see LibraryStats.
+    LibraryStats stats() const {
+        if (!counters_) return LibraryStats();
+        return counters_->Snapshot();
+    }
+
+    // How this library was loaded, nullptr unless with LoadOptions::trace.
+    const LoadTrace* load_trace() const { return load_trace_.get(); }
+
+    UnloadPolicy unload_policy() const { return unload_policy_; }
+
+    void set_unload_policy(UnloadPolicy policy) { unload_policy_ = policy; }
+
+    void Reset(internal::NativeLibrary library) {
+        internal::LibraryReaper::GetInstance()->Unload(library_, unload_policy_);
+        library_ = library;
+        symbols_.Clear();
+        RenewLookups();
+        if (!ClearManifest()) return;
+        LoadManifest();
+    }
+
+    // Returns the native library handle and removes it from this object. The
+    // caller must manage the lifetime of the handle.
+    // Otherwise, when we hold the wellknown library's handler, result should be nullptr.
+    auto Release() {
+        auto result = library_;
+        library_ = nullptr;
+        symbols_.Clear();
+        RenewLookups();
+        ClearManifest();
+        return result;
+    }
+
+private:
+    // Swaps |lookup| in for FindFunctionPointer(), which reads |slot| without
+    // a lock. The one replaced may still be read, so every lookup published
+    // is kept until this object goes; they are replaced a few times at most.
+    template<typename T>
+    void PublishLookup(std::atomic<T*>* slot, T* lookup) {
+        if (lookup) lookups_.emplace_back(std::shared_ptr<T>(lookup));
+        slot->store(lookup, std::memory_order_release);
+    }
+
+    // Starts the lookups over, the module changed.
+    void RenewLookups() {
+        std::lock_guard<std::mutex> guard(lookups_lock_);
+        if (auto index = export_index_.load(std::memory_order_relaxed))
+            PublishLookup(&export_index_, new internal::ExportIndex(index->cache_path()));
+        if (auto map = ordinal_map_.load(std::memory_order_relaxed))
+            PublishLookup(&ordinal_map_, new internal::OrdinalMap(map->path(), map->cache_path()));
+    }
+
+    // The manifest bindings are only dropped with the module they point into.
+    static const uint64_t kManifestGeneration = 1;
+
+    // Returns whether a manifest was bound.
+    bool ClearManifest() {
+        if (!has_manifest_.exchange(false, std::memory_order_acq_rel)) return false;
+        manifest_.Clear();
+        return true;
+    }
+
+    // Handles we own can't be unmapped under us, so their symbols stay valid
+    // until Reset() or Release(), and so do the wellknown library's, once
+    // pinned. Pinning happens here, before the generation is read, so that no
+    // entry is inserted for a mapping older than the pin. Until the wellknown
+    // library is loaded, 0 disables the cache.
+    uint64_t symbols_generation() const {
+        if (!is_wellknown()) return 1;
+        return pinned_library() ? 1 : 0;
+    }
+
+    bool is_wellknown() const { return library_id_ != internal::kNoModule; }
+
+    // The wellknown library, referenced from the first time it is found
+    // loaded so that it stays mapped as long as this object, and binding its
+    // exports takes no module lookup. nullptr while not loaded.
+    internal::NativeLibrary pinned_library() const {
+        auto library = pinned_.load(std::memory_order_acquire);
+        if (library || !is_wellknown()) return library;
+        library = internal::PinWellKnownLibrary(library_name());
+        if (!library) return nullptr;
+        internal::NativeLibrary pinned = nullptr;
+        if (!pinned_.compare_exchange_strong(pinned, library, std::memory_order_acq_rel)) {
+            internal::UnloadNativeLibrary(library);
+            return pinned;
+        }
+        // Drop what was resolved before, from a mapping which may be gone.
+        symbols_.Clear();
+        return library;
+    }
+
+    // |signature| 0 when the caller doesn't know it.
+    void* FindFunctionPointer(const char* name, uint64_t hash, uint64_t signature = 0) const {
+        void* address = nullptr;
+        uint64_t exported = 0;
+        if (has_manifest_.load(std::memory_order_acquire) &&
+            manifest_.Find(name, hash, kManifestGeneration, &address, &exported)) {
+            if (signature != 0 && exported != 0 && signature != exported) address = nullptr;
+            internal::RecordLookup(counters_.get(), true, 0, address != nullptr);
+            return address;
+        }
+        auto generation = symbols_generation();
+        if (symbols_.Find(name, hash, generation, &address)) {
+            internal::RecordLookup(counters_.get(), true, 0, address != nullptr);
+            return address;
+        }
+        if (!is_valid()) return nullptr;
+        auto start = internal::StatsNow();
+        if (is_wellknown()) address = internal::GetFunctionPointerFromNativeLibrary(pinned_library(), name);
+        else {
+            auto ordinal_map = ordinal_map_.load(std::memory_order_acquire);
+            auto export_index = export_index_.load(std::memory_order_acquire);
+            if ((!ordinal_map || !ordinal_map->Find(library_, name, hash, &address)) &&
+                (!export_index || !export_index->Find(library_, name, hash, &address)))
+                address = internal::GetFunctionPointerFromNativeLibrary(library_, name);
+        }
+        symbols_.Insert(name, hash, generation, address);
+        internal::RecordLookup(counters_.get(), false, start, address != nullptr);
+        return address;
+    }
+
+private:
+    internal::ModuleId library_id_ = internal::kNoModule;
+    internal::NativeLibrary library_ = nullptr;
+    mutable std::atomic<internal::NativeLibrary> pinned_{nullptr};
+    UnloadPolicy unload_policy_ = UnloadPolicy::kImmediate;
+    mutable internal::SymbolCache symbols_;
+    internal::SymbolCache manifest_;
+    std::atomic<bool> has_manifest_{false};
+    // Both owned by |lookups_|.
+    std::atomic<internal::ExportIndex*> export_index_{nullptr};
+    std::atomic<internal::OrdinalMap*> ordinal_map_{nullptr};
+    std::mutex lookups_lock_;
+    std::vector<std::shared_ptr<void>> lookups_;
+    std::unique_ptr<internal::LibraryCounters> counters_ = internal::LibraryCounters::Create();
+    std::unique_ptr<LoadTrace> load_trace_;
+    DISALLOW_COPY_AND_ASSIGN(DynamicLibrary);
+};
+
+template<typename R, typename... P>
+typename FunctorTraits<R, P...>::Type GetFunctionPointer(const internal::NativeLibrary& library, const std::string& InterfaceName) {
+    if (!library || InterfaceName.empty()) return nullptr;
+    using Type = typename FunctorTraits<R, P...>::Type;
+    return reinterpret_cast<Type>(internal::GetFunctionPointerFromNativeLibrary(library, InterfaceName.c_str()));
+}
+
+template<typename R, typename... P>
+typename FunctorTraits<R, P...>::Type GetFunctionPointer(const DynamicLibrary* library, const std::string& InterfaceName) {
+    if (!library) return nullptr;
+    return library->GetFunctionPointer<R, P...>(InterfaceName);
+}
+
+template<typename R, typename... P>
+typename FunctorTraits<R, P...>::Type GetFunctionPointer(const std::weak_ptr<DynamicLibrary>& library, const std::string& InterfaceName) {
+    auto known_library = library.lock();
+    if (!known_library) return nullptr;
+    return known_library->GetFunctionPointer<R, P...>(InterfaceName);
+}
+
+template<typename R, typename... P>
+typename Symbol<R, P...>::Type GetFunctionPointer(const internal::NativeLibrary& library, const Symbol<R, P...>& symbol) {
+    if (!library) return nullptr;
+    using Type = typename Symbol<R, P...>::Type;
+    return reinterpret_cast<Type>(internal::GetFunctionPointerFromNativeLibrary(library, symbol.name()));
+}
+
+template<typename R, typename... P>
+typename Symbol<R, P...>::Type GetFunctionPointer(const DynamicLibrary* library, const Symbol<R, P...>& symbol) {
+    if (!library) return nullptr;
+    return library->GetFunctionPointer(symbol);
+}
+
+template<typename R, typename... P>
+typename Symbol<R, P...>::Type GetFunctionPointer(const std::weak_ptr<DynamicLibrary>& library, const Symbol<R, P...>& symbol) {
+    auto known_library = library.lock();
+    if (!known_library) return nullptr;
+    return known_library->GetFunctionPointer(symbol);
+}
+
+// What all the DynamicLibrary objects counted so far, see LibraryStats.
+inline LibraryStats GetProcessLibraryStats() {
+    auto counters = internal::LibraryCounters::Process();
+    if (!counters) return LibraryStats();
+    return counters->Snapshot();
+}
+
+// The latest traced loads, oldest first, see LoadOptions::trace.
+inline std::vector<LoadTrace> GetLoadTraces() {
+    return internal::LoadTracer::GetInstance()->Traces();
+}
+
+// Unloads the modules released with UnloadPolicy::kDeferred so far, on the
+// calling thread. Returns how many were unloaded.
+inline size_t FlushDeferredUnloads() {
+    return internal::LibraryReaper::GetInstance()->FlushDeferred();
+}
+
+// Stops the thread unloading the modules released with
+// UnloadPolicy::kBackground, once it unloaded those queued, see
+// internal::LibraryReaper. Needed before unloading a module including this
+// header, the thread runs its code, and not from its DllMain. The later
+// releases unload on the releasing thread.
+inline void StopBackgroundUnloads() {
+    internal::LibraryReaper::GetInstance()->Stop();
+}
+
+// Shares one DynamicLibrary, and so one symbol cache, between all the users of
+// a library file. Libraries are keyed by internal::CanonicalLibraryPath() and
+// only weakly referenced, a library is unloaded once its last user is gone.
+class LibraryRegistry {
+public:
+    // Leaked on purpose, libraries may be released during static destruction.
+    static LibraryRegistry* GetInstance() {
+        static LibraryRegistry* instance = new LibraryRegistry();
+        return instance;
+    }
+
+    // Returns the library loaded from |path|, loading it when no one holds it
+    // yet with |options|, or nullptr when it can't be loaded.
+    std::shared_ptr<DynamicLibrary> Open(const std::wstring& path, const LoadOptions& options = LoadOptions()) {
+        auto key = internal::CanonicalLibraryPath(path);
+        auto known_library = Find(key);
+        if (known_library) return known_library;
+
+        // Loading runs the library's DllMain, don't hold the lock meanwhile.
+        // A thread racing us on the same file wins, and our reference is
+        // dropped again.
+        auto library = std::make_shared<DynamicLibrary>(path, options);
+        if (!library->is_valid()) return nullptr;
+        std::lock_guard<std::mutex> guard(lock_);
+        auto& slot = libraries_[key];
+        known_library = slot.lock();
+        if (known_library) return known_library;
+        slot = library;
+        return library;
+    }
+
+    // See DynamicLibrary::LoadAsync().
+    DynamicLibrary::Future OpenAsync(const std::wstring& path, const DynamicLibrary::Executor& executor,
+                                     const std::vector<std::string>& exports, const DynamicLibrary::LoadCallback& callback,
+                                     const LoadOptions& options = LoadOptions()) {
+        auto key = internal::CanonicalLibraryPath(path);
+        Waiter waiter;
+        waiter.exports = exports;
+        waiter.callback = callback;
+        auto result = waiter.promise.get_future().share();
+        std::shared_ptr<DynamicLibrary> known_library;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            auto it = libraries_.find(key);
+            if (it != libraries_.end()) known_library = it->second.lock();
+            if (!known_library) {
+                auto& waiters = pending_[key];
+                bool loading = !waiters.empty();
+                waiters.push_back(std::move(waiter));
+                if (loading) return result;
+            }
+        }
+        // Already loaded, there is no load to wait for.
+        if (known_library) {
+            Resolve(&waiter, known_library);
+            return result;
+        }
+        // The waiters are failed if the executor throws or drops the task
+        // without running it, else they would wait forever.
+        auto load = std::make_shared<PendingLoad>(this, path, options, key);
+        auto task = [load] { load->Run(); };
+        try {
+            if (executor) executor(task);
+            else std::thread(task).detach();
+        } catch (...) {
+            load->Abandon();
+        }
+        return result;
+    }
+
+    // Returns the library loaded from |path| if someone still holds it.
+    std::shared_ptr<DynamicLibrary> Find(const std::wstring& path) const {
+        auto key = internal::CanonicalLibraryPath(path);
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = libraries_.find(key);
+        if (it == libraries_.end()) return nullptr;
+        return it->second.lock();
+    }
+
+    // Forgets the libraries no one holds anymore.
+    void Purge() {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (auto it = libraries_.begin(); it != libraries_.end();) {
+            if (it->second.expired()) it = libraries_.erase(it);
+            else ++it;
+        }
+    }
+
+private:
+    struct Waiter {
+        std::vector<std::string> exports;
+        DynamicLibrary::LoadCallback callback;
+        std::promise<std::shared_ptr<DynamicLibrary>> promise;
+    };
+
+    // The load shared by the copies of the task given to the executor. Running
+    // it, abandoning it or dropping every copy unrun completes the waiters,
+    // whichever comes first.
+    class PendingLoad {
+    public:
+        PendingLoad(LibraryRegistry* registry, const std::wstring& path, const LoadOptions& options,
+                    const std::wstring& key)
+            : registry_(registry), path_(path), options_(options), key_(key) {}
+        ~PendingLoad() { Abandon(); }
+
+        void Run() {
+            if (!done_.exchange(true)) registry_->CompleteAsync(path_, options_, key_);
+        }
+
+        void Abandon() {
+            if (!done_.exchange(true)) registry_->Complete(key_, nullptr);
+        }
+
+    private:
+        LibraryRegistry* registry_;
+        std::wstring path_;
+        LoadOptions options_;
+        std::wstring key_;
+        std::atomic<bool> done_{false};
+        DISALLOW_COPY_AND_ASSIGN(PendingLoad);
+    };
+
+    LibraryRegistry() {}
+
+    // Open() registers the library before the waiters are taken, the requests
+    // coming later find it loaded. A load that throws fails the waiters.
+    void CompleteAsync(const std::wstring& path, const LoadOptions& options, const std::wstring& key) {
+        std::shared_ptr<DynamicLibrary> library;
+        try {
+            library = Open(path, options);
+        } catch (...) {
+            library = nullptr;
+        }
+        Complete(key, library);
+    }
+
+    void Complete(const std::wstring& key, const std::shared_ptr<DynamicLibrary>& library) {
+        std::vector<Waiter> waiters;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            auto it = pending_.find(key);
+            if (it == pending_.end()) return;
+            waiters.swap(it->second);
+            pending_.erase(it);
+        }
+        for (auto& waiter : waiters) Resolve(&waiter, library);
+    }
+
+    // Resolves |waiter|'s exports, then completes it.
+    static void Resolve(Waiter* waiter, const std::shared_ptr<DynamicLibrary>& library) {
+        auto result = library;
+        for (const auto& name : waiter->exports) {
+            if (result && !result->GetFunctionPointer(name.c_str())) result = nullptr;
+        }
+        waiter->promise.set_value(result);
+        if (waiter->callback) waiter->callback(result);
+    }
+
+    mutable std::mutex lock_;
+    std::unordered_map<std::wstring, std::weak_ptr<DynamicLibrary>> libraries_;
+    // The requests waiting for a library being loaded.
+    std::unordered_map<std::wstring, std::vector<Waiter>> pending_;
+    DISALLOW_COPY_AND_ASSIGN(LibraryRegistry);
+};
+
+inline DynamicLibrary::Future DynamicLibrary::LoadAsync(const std::wstring& path, const Executor& executor,
+                                                       const std::vector<std::string>& exports, const LoadCallback& callback,
+                                                       const LoadOptions& options) {
+    return LibraryRegistry::GetInstance()->OpenAsync(path, executor, exports, callback, options);
 }
 
 } // namespace utils
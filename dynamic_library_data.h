@@ -0,0 +1,197 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef UTILS_DYNAMIC_LIBRARY_DATA_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_DATA_INCLUDE_H_
+
+#include <cstring>
+
+#include "dynamic_library.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <elf.h>
+#endif
+#endif
+
+namespace utils {
+
+// A read-only view into a mapped library, valid while the library is.
+struct ByteSpan {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    bool empty() const { return size == 0; }
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+};
+
+// Maps a library holding nothing but data, embedded resources or lookup
+// tables, without loading it: no DllMain, no import resolution and no
+// relocations. Its sections and resources are read in place.
+//
+// Windows maps the image read-only with LOAD_LIBRARY_AS_IMAGE_RESOURCE, other
+// platforms mmap() the file and read its ELF sections, they have no resources.
+class DataLibrary {
+public:
+    explicit DataLibrary(const std::wstring& path) { Map(path); }
+    virtual ~DataLibrary() { Unmap(); }
+
+    bool is_valid() const;
+
+    // Returns the section named |name|, ".rdata" for example, or an empty span.
+    ByteSpan GetSection(const char* name) const;
+
+    // Returns the resource |name| of |type|, MAKEINTRESOURCE() ids included,
+    // or an empty span.
+    ByteSpan GetResource(const wchar_t* type, const wchar_t* name) const;
+
+    ByteSpan GetResource(int type, int id) const;
+
+private:
+    void Map(const std::wstring& path);
+    void Unmap();
+
+#if defined(_WIN32)
+    HMODULE module_ = nullptr;
+#else
+    void* mapping_ = nullptr;
+    size_t size_ = 0;
+#endif
+    DISALLOW_COPY_AND_ASSIGN(DataLibrary);
+};
+
+#if defined(_WIN32)
+
+inline bool DataLibrary::is_valid() const { return module_ != nullptr; }
+
+inline void DataLibrary::Map(const std::wstring& path) {
+    module_ = ::LoadLibraryExW(path.c_str(), nullptr, LOAD_LIBRARY_AS_IMAGE_RESOURCE | LOAD_LIBRARY_AS_DATAFILE);
+}
+
+inline void DataLibrary::Unmap() {
+    internal::UnloadNativeLibrary(module_);
+    module_ = nullptr;
+}
+
+inline ByteSpan DataLibrary::GetSection(const char* name) const {
+    ByteSpan result;
+    if (!module_ || !name || std::strlen(name) > IMAGE_SIZEOF_SHORT_NAME) return result;
+    // The low bits of the handle tell how it was mapped, the rest is the base.
+    auto base = reinterpret_cast<const BYTE*>(reinterpret_cast<ULONG_PTR>(module_) & ~static_cast<ULONG_PTR>(3));
+    auto dos_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+    if (dos_header->e_magic != IMAGE_DOS_SIGNATURE) return result;
+    auto nt_headers = reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dos_header->e_lfanew);
+    if (nt_headers->Signature != IMAGE_NT_SIGNATURE) return result;
+    auto section = IMAGE_FIRST_SECTION(nt_headers);
+    for (WORD i = 0; i < nt_headers->FileHeader.NumberOfSections; ++i, ++section) {
+        if (std::strncmp(name, reinterpret_cast<const char*>(section->Name), IMAGE_SIZEOF_SHORT_NAME) != 0) continue;
+        result.data = base + section->VirtualAddress;
+        result.size = section->Misc.VirtualSize;
+        break;
+    }
+    return result;
+}
+
+inline ByteSpan DataLibrary::GetResource(const wchar_t* type, const wchar_t* name) const {
+    ByteSpan result;
+    if (!module_) return result;
+    HRSRC resource = ::FindResourceW(module_, name, type);
+    if (!resource) return result;
+    HGLOBAL loaded = ::LoadResource(module_, resource);
+    if (!loaded) return result;
+    result.data = static_cast<const uint8_t*>(::LockResource(loaded));
+    result.size = result.data ? ::SizeofResource(module_, resource) : 0;
+    return result;
+}
+
+inline ByteSpan DataLibrary::GetResource(int type, int id) const {
+    return GetResource(MAKEINTRESOURCEW(type), MAKEINTRESOURCEW(id));
+}
+
+#else  // defined(_WIN32)
+
+inline bool DataLibrary::is_valid() const { return mapping_ != nullptr; }
+
+inline void DataLibrary::Map(const std::wstring& path) {
+    int file = ::open(internal::WideToUTF8(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return;
+    struct stat info;
+    if (::fstat(file, &info) == 0 && info.st_size > 0) {
+        void* mapping = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping != MAP_FAILED) {
+            mapping_ = mapping;
+            size_ = static_cast<size_t>(info.st_size);
+        }
+    }
+    ::close(file);
+}
+
+inline void DataLibrary::Unmap() {
+    if (mapping_) ::munmap(mapping_, size_);
+    mapping_ = nullptr;
+    size_ = 0;
+}
+
+inline ByteSpan DataLibrary::GetSection(const char* name) const {
+    ByteSpan result;
+#if defined(__linux__)
+#if UINTPTR_MAX == 0xffffffffu
+    using Header = Elf32_Ehdr;
+    using SectionHeader = Elf32_Shdr;
+    const unsigned char elf_class = ELFCLASS32;
+#else
+    using Header = Elf64_Ehdr;
+    using SectionHeader = Elf64_Shdr;
+    const unsigned char elf_class = ELFCLASS64;
+#endif
+    if (!mapping_ || !name || size_ < sizeof(Header)) return result;
+    auto base = static_cast<const uint8_t*>(mapping_);
+    auto header = reinterpret_cast<const Header*>(base);
+    if (std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != elf_class) return result;
+    if (header->e_shoff == 0 || header->e_shentsize != sizeof(SectionHeader) ||
+        header->e_shoff + header->e_shnum * sizeof(SectionHeader) > size_ || header->e_shstrndx >= header->e_shnum) {
+        return result;
+    }
+    auto sections = reinterpret_cast<const SectionHeader*>(base + header->e_shoff);
+    const auto& names = sections[header->e_shstrndx];
+    if (names.sh_offset + names.sh_size > size_) return result;
+    for (size_t i = 0; i < header->e_shnum; ++i) {
+        const auto& section = sections[i];
+        if (section.sh_name >= names.sh_size) continue;
+        const char* section_name = reinterpret_cast<const char*>(base + names.sh_offset + section.sh_name);
+        auto max_length = names.sh_size - section.sh_name;
+        if (strnlen(section_name, max_length) == max_length || std::strcmp(name, section_name) != 0) continue;
+        // SHT_NOBITS sections, .bss for example, take no room in the file.
+        if (section.sh_type == SHT_NOBITS || section.sh_offset + section.sh_size > size_) break;
+        result.data = base + section.sh_offset;
+        result.size = section.sh_size;
+        break;
+    }
+#endif  // defined(__linux__)
+    return result;
+}
+
+inline ByteSpan DataLibrary::GetResource(const wchar_t*, const wchar_t*) const {
+    return ByteSpan();
+}
+
+inline ByteSpan DataLibrary::GetResource(int, int) const {
+    return ByteSpan();
+}
+
+#endif  // defined(_WIN32)
+
+} // namespace utils
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_DATA_INCLUDE_H_
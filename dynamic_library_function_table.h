@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef UTILS_DYNAMIC_LIBRARY_FUNCTION_TABLE_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_FUNCTION_TABLE_INCLUDE_H_
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstring>
+
+#include "dynamic_library.h"
+
+namespace utils {
+
+// The exports bound by BindFunctionTable(), in the order of their names.
+template<size_t N>
+class FunctionTable {
+public:
+    FunctionTable() { pointers_.fill(nullptr); }
+
+    void* operator[](size_t index) const { return pointers_[index]; }
+
+    template<typename R, typename... P>
+    typename FunctorTraits<R, P...>::Type Get(size_t index) const {
+        using Type = typename FunctorTraits<R, P...>::Type;
+        return reinterpret_cast<Type>(pointers_[index]);
+    }
+
+    // Returns true when the name at |index| is not exported.
+    bool missing(size_t index) const { return missing_.test(index); }
+
+    size_t missing_count() const { return missing_.count(); }
+
+    bool complete() const { return missing_.none(); }
+
+    const std::array<void*, N>& pointers() const { return pointers_; }
+
+private:
+    template<size_t M>
+    friend FunctionTable<M> BindFunctionTable(const DynamicLibrary& library, const char* const (&names)[M]);
+
+    std::array<void*, N> pointers_;
+    std::bitset<N> missing_;
+};
+
+// Resolves all of |names| from the module's export directory instead of a
+// GetProcAddress call per name: one pass merging the sorted names with the E
+// exports, or a binary search per name when N log E is below E. The results
+// are also recorded into the library's symbol cache.
+//
+//   constexpr const char* kNames[] = {"CreateFoo", "DestroyFoo"};
+//   auto table = utils::BindFunctionTable(*library, kNames);
+//   auto create = table.Get<Foo*>(0);
+template<size_t N>
+FunctionTable<N> BindFunctionTable(const DynamicLibrary& library, const char* const (&names)[N]) {
+    FunctionTable<N> table;
+    table.missing_.set();
+    if (!library.is_valid()) return table;
+
+#if defined(_WIN32)
+    internal::ExportDirectory exports(library.native_library());
+    if (exports.is_valid()) {
+        std::array<size_t, N> order;
+        for (size_t i = 0; i < N; ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&names](size_t a, size_t b) {
+            return std::strcmp(names[a], names[b]) < 0;
+        });
+        auto bind = [&](size_t i, DWORD export_index) {
+            void* address = exports.FunctionAt(export_index);
+            table.pointers_[order[i]] = address;
+            table.missing_.set(order[i], address == nullptr);
+            library.CacheFunctionPointer(names[order[i]], address);
+        };
+        DWORD export_count = exports.name_count();
+        size_t log_count = 1;
+        for (DWORD count = export_count; count > 1; count >>= 1) ++log_count;
+        DWORD export_index = 0;
+        if (N * log_count < export_count) {
+            // A few names in a large directory, a binary search each is
+            // cheaper than the merge.
+            for (size_t i = 0; i < N; ++i) {
+                DWORD found = 0;
+                if (!exports.FindName(names[order[i]], export_index, &found)) continue;
+                export_index = found;
+                bind(i, found);
+            }
+            return table;
+        }
+        // Merge the sorted requests with the sorted export names.
+        for (size_t i = 0; i < N && export_index < export_count;) {
+            int compare = std::strcmp(names[order[i]], exports.NameAt(export_index));
+            if (compare > 0) {
+                ++export_index;
+                continue;
+            }
+            if (compare == 0) bind(i, export_index);
+            ++i;
+        }
+        return table;
+    }
+#endif  // defined(_WIN32)
+
+    // Not mapped as an image we can read, resolve one by one.
+    for (size_t i = 0; i < N; ++i) {
+        table.pointers_[i] = library.GetFunctionPointer(names[i]);
+        table.missing_.set(i, table.pointers_[i] == nullptr);
+    }
+    return table;
+}
+
+} // namespace utils
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_FUNCTION_TABLE_INCLUDE_H_
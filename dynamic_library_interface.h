@@ -9,7 +9,10 @@
 #ifndef UTILS_DYNAMIC_LIBRARY_INTERFACE_INCLUDE_H_
 #define UTILS_DYNAMIC_LIBRARY_INTERFACE_INCLUDE_H_
 
+#include <atomic>
+#include <functional>
 #include <mutex>
+#include <type_traits>
 
 #include "dynamic_library.h"
 
@@ -19,6 +22,8 @@ namespace subtle {
 
 template<typename NativeInterface>
 struct Pointer {
+using Function = typename FunctorTraits<void, NativeInterface*>::Type;
+
 static void Destruct(const std::weak_ptr<DynamicLibrary>& library, const std::string& InterfaceName, NativeInterface** inter) {
     if (!inter) return;
     NativeInterface* ptr = *inter;
@@ -27,10 +32,14 @@ static void Destruct(const std::weak_ptr<DynamicLibrary>& library, const std::st
     if (!destroctor) return;
     destroctor(ptr);
 }
+
+static void Destroy(Function destroctor, NativeInterface* ptr) { destroctor(ptr); }
 };
 
 template<typename NativeInterface>
 struct DoublePointer {
+using Function = typename FunctorTraits<void, NativeInterface**>::Type;
+
 static void Destruct(const std::weak_ptr<DynamicLibrary>& library, const std::string& InterfaceName, NativeInterface** inter) {
     if (!inter) return;
     NativeInterface* ptr = *inter;
@@ -39,29 +48,127 @@ static void Destruct(const std::weak_ptr<DynamicLibrary>& library, const std::st
     if (!destroctor) return;
     destroctor(&ptr);
 }
+
+static void Destroy(Function destroctor, NativeInterface* ptr) { destroctor(&ptr); }
+};
+
+// Resolves the export |name| as a Function pointer, with the signature it
+// tells for the manifest to check, or untyped when it is no function pointer
+// type.
+template<typename Function>
+struct ExportLookup {
+    static Function Resolve(const std::weak_ptr<DynamicLibrary>& library, const std::string& name) {
+        auto known_library = library.lock();
+        if (!known_library || name.empty()) return nullptr;
+        return reinterpret_cast<Function>(known_library->GetFunctionPointer(name.c_str()));
+    }
+};
+
+template<typename R, typename... A>
+struct ExportLookup<R(UTILS_LIBRARY_CALL*)(A...)> {
+    using Function = R(UTILS_LIBRARY_CALL*)(A...);
+
+    static Function Resolve(const std::weak_ptr<DynamicLibrary>& library, const std::string& name) {
+        return GetFunctionPointer<R, A...>(library, name);
+    }
 };
 
+// Whether DestructTraits lets the destroy export be resolved once: it names
+// its type Function and calls it with a static Destroy(Function,
+// NativeInterface*). The traits written before only have Destruct(), which
+// looks the export up again on every destruction.
+template<typename DestructTraits, typename NativeInterface, typename = void>
+struct HasDestroyFunction : std::false_type {
+    using Function = void*;
+};
+
+template<typename DestructTraits, typename NativeInterface>
+struct HasDestroyFunction<DestructTraits, NativeInterface,
+                          std::void_t<typename DestructTraits::Function,
+                                      decltype(DestructTraits::Destroy(std::declval<typename DestructTraits::Function>(),
+                                                                       std::declval<NativeInterface*>()))>>
+    : std::true_type {
+    using Function = typename DestructTraits::Function;
+};
+
+// Owns one native interface created by the library. The destroy export is
+// resolved along with the create one, so destroying costs no lookup and, as
+// nothing but a weak reference is kept, no allocation. The object isn't
+// created when the destroy export is missing. A DestructTraits with Destruct()
+// only still works, through a Destructor bound to the export's name.
 template<typename NativeInterface, typename DestructTraits>
 class NativeTraits {
+    using Resolved = HasDestroyFunction<DestructTraits, NativeInterface>;
+
 public:
+    static constexpr bool kResolvesDestroy = Resolved::value;
+
     using Destructor = std::function<void(NativeInterface**)>;
+    using DestroyFunction = typename Resolved::Function;
+    // Takes the object instead of the destroy export, with what the owner
+    // given along keeps alive.
+    using Release = void (*)(void* owner, DestroyFunction destroy, NativeInterface* inter);
 
     explicit NativeTraits(NativeInterface* inter, const Destructor& destructor)
-        : inteface_(inter)
-        , destructor_(destructor) {}
+        : destructor_(new Destructor(destructor))
+        , interface_(inter) {}
+
+    // Adopts |inter|, destroyed by |destroy| unless |library| is gone by then.
+    explicit NativeTraits(const std::weak_ptr<DynamicLibrary>& library, NativeInterface* inter, DestroyFunction destroy)
+        : library_(library)
+        , destroy_(destroy)
+        , interface_(inter) {}
+
+    // Adopts |inter|, handed to |release| along with |owner| and |destroy|.
+    // |owner| is kept alive as long as the object.
+    explicit NativeTraits(const std::shared_ptr<void>& owner, NativeInterface* inter, DestroyFunction destroy, Release release)
+        : destroy_(destroy)
+        , owner_(owner)
+        , release_(release)
+        , interface_(inter) {}
 
     explicit NativeTraits(const std::weak_ptr<DynamicLibrary>& library, const std::string& CreateInterface, const std::string& DestroyInterface)
-        : interface_(NativeTraits::Contruct(library, CreateInterface))
-        , destructor_(NativeTraits::Destruct(library, DestroyInterface)) {}
+        : library_(library)
+        , destroy_(NativeTraits::ResolveDestroy(library, DestroyInterface))
+        , interface_(destroy_ ? NativeTraits::Contruct(library, CreateInterface) : nullptr) {
+        BindDestructor(library, DestroyInterface);
+    }
 
     template<typename... P>
     explicit NativeTraits(const std::weak_ptr<DynamicLibrary>& library, const std::string& CreateInterface, const std::string& DestroyInterface, P&&... args)
-        : interface_(NativeTraits::Contruct<P...>(library, CreateInterface, std::forward<P...>(args)...))
-        , destructor_(NativeTraits::Destruct(library, DestroyInterface)) {}
+        : library_(library)
+        , destroy_(NativeTraits::ResolveDestroy(library, DestroyInterface))
+        , interface_(destroy_ ? NativeTraits::Contruct<typename std::decay<P>::type...>(library, CreateInterface, std::forward<P>(args)...) : nullptr) {
+        BindDestructor(library, DestroyInterface);
+    }
+
+    // Same with the exports named by symbols, a destroy export not matching
+    // DestructTraits or arguments not matching the create one don't compile.
+    template<typename... A, typename... D, typename... P>
+    explicit NativeTraits(const std::weak_ptr<DynamicLibrary>& library, const Symbol<NativeInterface*, A...>& CreateInterface, const Symbol<void, D...>& DestroyInterface, P&&... args)
+        : library_(library)
+        , destroy_(NativeTraits::ResolveDestroy(library, DestroyInterface))
+        , interface_(destroy_ ? NativeTraits::Contruct(library, CreateInterface, std::forward<P>(args)...) : nullptr) {
+        BindDestructor(library, DestroyInterface.name());
+    }
 
     virtual ~NativeTraits() {
-        if (!interface_ || !destructor_) return;
-        destructor_(&interface_);
+        if (!interface_) return;
+        if (destructor_) {
+            (*destructor_)(&interface_);
+            return;
+        }
+        NativeInterface* inter = interface_;
+        interface_ = nullptr;
+        if (release_) {
+            release_(owner_.get(), destroy_, inter);
+            return;
+        }
+        if (!destroy_) return;
+        // Nothing is left to call once the library has been unloaded.
+        auto library = library_.lock();
+        if (!library) return;
+        Destroy(destroy_, inter);
     }
 
     template<typename... P>
@@ -69,21 +176,79 @@ public:
 #ifdef TEST
         const unsigned number = sizeof...(P);
 #endif
-        auto contructor = GetFunctionPointer<NativeInterface*, P...>(library, InterfaceName);
+        auto contructor = ResolveCreate<P...>(library, InterfaceName);
         if (!contructor) return nullptr;
         return contructor(args...);
     }
 
+    template<typename... A, typename... P>
+    static NativeInterface* Contruct(const std::weak_ptr<DynamicLibrary>& library, const Symbol<NativeInterface*, A...>& InterfaceName, P&&... args) {
+        static_assert(sizeof...(A) == sizeof...(P), "wrong number of arguments for the create export");
+        auto contructor = GetFunctionPointer(library, InterfaceName);
+        if (!contructor) return nullptr;
+        return contructor(std::forward<P>(args)...);
+    }
+
     static Destructor Destruct(const std::weak_ptr<DynamicLibrary>& library, const std::string& InterfaceName) {
         return [library, InterfaceName](NativeInterface** inter) {
             DestructTraits::Destruct(library, InterfaceName, inter);
         };
     }
 
+    // The create export named by a string, called with arguments of the types
+    // |P|. They are deduced from the call rather than declared, so they aren't
+    // checked against the manifest's signature: a literal 1 passed for a long
+    // would not match. Symbols declare it, see the overload below.
+    template<typename... P>
+    static typename FunctorTraits<NativeInterface*, P...>::Type ResolveCreate(const std::weak_ptr<DynamicLibrary>& library,
+                                                                            const std::string& InterfaceName) {
+        using Type = typename FunctorTraits<NativeInterface*, P...>::Type;
+        return reinterpret_cast<Type>(ExportLookup<void*>::Resolve(library, InterfaceName));
+    }
+
+    // Looked up with the signature of DestructTraits::Function.
+    static DestroyFunction ResolveDestroy(const std::weak_ptr<DynamicLibrary>& library, const std::string& InterfaceName) {
+        internal::RecordDestroyResolution();
+        return ExportLookup<DestroyFunction>::Resolve(library, InterfaceName);
+    }
+
+    template<typename... D>
+    static DestroyFunction ResolveDestroy(const std::weak_ptr<DynamicLibrary>& library, const Symbol<void, D...>& InterfaceName) {
+        static_assert(!Resolved::value || std::is_same<typename Symbol<void, D...>::Type, DestroyFunction>::value,
+                      "the destroy export doesn't match DestructTraits");
+        internal::RecordDestroyResolution();
+        return reinterpret_cast<DestroyFunction>(GetFunctionPointer(library, InterfaceName));
+    }
+
+    // Calls |destroy| the way DestructTraits does.
+    static void Destroy(DestroyFunction destroy, NativeInterface* inter) {
+        if constexpr (Resolved::value) DestructTraits::Destroy(destroy, inter);
+    }
+
+    // A Release going to the destroy export, for the owners which only keep
+    // the library alive.
+    static void DestroyRelease(void* /* owner */, DestroyFunction destroy, NativeInterface* inter) {
+        if (destroy) Destroy(destroy, inter);
+    }
+
     NativeInterface* get() const { return interface_; }
 
 protected:
-    Destructor destructor_;
+    // The destroy export is only resolved to tell it exists, the traits
+    // without Destroy() look it up again by name when destroying.
+    void BindDestructor(const std::weak_ptr<DynamicLibrary>& library, const std::string& DestroyInterface) {
+        if constexpr (!Resolved::value) {
+            if (interface_) destructor_.reset(new Destructor(NativeTraits::Destruct(library, DestroyInterface)));
+        }
+    }
+
+    std::weak_ptr<DynamicLibrary> library_;
+    DestroyFunction destroy_ = nullptr;
+    std::shared_ptr<void> owner_;
+    Release release_ = nullptr;
+    // Only for the objects adopted with a Destructor, or destroyed by a
+    // DestructTraits without Destroy().
+    std::unique_ptr<Destructor> destructor_;
     NativeInterface* interface_ = nullptr;
 };
 
@@ -93,19 +258,59 @@ using PointerTraits = NativeTraits<NativeInterface, Pointer<NativeInterface>>;
 template<typename NativeInterface>
 using DoublePointerTraits = NativeTraits<NativeInterface, DoublePointer<NativeInterface>>;
 
+// Tells whether it is used on the thread which created it, or on the first
+// thread using it after DetachFromThread(). Lock-free, the thread id is only
+// ever swapped atomically.
 class ThreadFlag {
 public:
-    ThreadFlag() : valid_thread_id_(::GetCurrentThreadId()) {}
+    ThreadFlag() : valid_thread_id_(internal::CurrentThreadId()) {}
     virtual ~ThreadFlag() {}
 
     bool CalledOnValidThread() const {
-        std::lock_guard<std::mutex> guard(lock_);
-        return valid_thread_id_ == ::GetCurrentThreadId();
+        auto current_thread_id = internal::CurrentThreadId();
+        auto valid_thread_id = valid_thread_id_.load(std::memory_order_acquire);
+        if (valid_thread_id == current_thread_id) return true;
+        if (valid_thread_id != internal::PlatformThreadId()) return false;
+        // Detached, the first caller binds it. A thread losing the race sees
+        // the winner's id.
+        if (valid_thread_id_.compare_exchange_strong(valid_thread_id, current_thread_id, std::memory_order_acq_rel)) return true;
+        return valid_thread_id == current_thread_id;
     }
 
+    // Hands the flag over to the next thread calling CalledOnValidThread().
+    void DetachFromThread() { valid_thread_id_.store(internal::PlatformThreadId(), std::memory_order_release); }
+
 private:
-    mutable std::mutex lock_;
-    mutable DWORD valid_thread_id_ = 0;
+    // A value initialized id, 0 on Windows, stands for no thread.
+    mutable std::atomic<internal::PlatformThreadId> valid_thread_id_;
+};
+
+// The batched variant of a function of a single argument, R(A): the export
+// void Name_batch(const A*, size_t, R*), or void Name_batch(const A*, size_t)
+// when R is void.
+template<typename R, typename... P>
+struct BatchTraits {};
+
+template<typename R, typename A>
+struct BatchTraits<R, A> {
+    using Argument = typename std::decay<A>::type;
+    using Result = typename std::decay<R>::type;
+    using Type = typename FunctorTraits<void, const Argument*, size_t, Result*>::Type;
+
+    static Type Resolve(const DynamicLibrary& library, const std::string& name) {
+        return library.GetFunctionPointer<void, const Argument*, size_t, Result*>(name);
+    }
+};
+
+template<typename A>
+struct BatchTraits<void, A> {
+    using Argument = typename std::decay<A>::type;
+    using Result = void;
+    using Type = typename FunctorTraits<void, const Argument*, size_t>::Type;
+
+    static Type Resolve(const DynamicLibrary& library, const std::string& name) {
+        return library.GetFunctionPointer<void, const Argument*, size_t>(name);
+    }
 };
 
 } // namespace subtle
@@ -114,30 +319,43 @@ private:
 template<typename NativeInterface, typename Traits = subtle::PointerTraits<NativeInterface>>
 class Interface {
 public:
+    // The traits are allocated by std::make_shared along with their reference
+    // count, so creating a handle costs one allocation and copying a strong one
+    // a single atomic increment. Moving costs none.
     explicit Interface() {}
-    explicit Interface(const Interface& r) { *this = r; }
+    Interface(const Interface& r) { *this = r; }
+    Interface(Interface&& r) { *this = std::move(r); }
     virtual ~Interface() { reset(); }
     Interface& operator=(const Interface& r) {
         interface_ = r.interface_;
         weak_interface_ = r.weak_interface_;
-        library_name_ = r.library_name_;
+        library_id_ = r.library_id_;
         if (!interface_) weak_flag_ = r.weak_flag_;
         return *this;
     }
+    Interface& operator=(Interface&& r) {
+        if (this == &r) return *this;
+        interface_ = std::move(r.interface_);
+        weak_interface_ = std::move(r.weak_interface_);
+        library_id_ = r.library_id_;
+        if (!interface_) weak_flag_ = std::move(r.weak_flag_);
+        r.reset();
+        return *this;
+    }
 
     Interface AstWeakPtr() {
         Interface tmp;
-        tmp.library_name_ = library_name_;
+        tmp.library_id_ = library_id_;
         if (interface_) tmp.weak_interface_ = interface_;
         else tmp.weak_interface_ = weak_interface_;
-        if (!flag_) flag_ = new subtle::ThreadFlag();
+        if (!flag_) flag_ = std::make_shared<subtle::ThreadFlag>();
         tmp.weak_flag_ = flag_;
         return tmp;
     }
 
     Interface AsRefPtr() {
         Interface tmp;
-        tmp.library_name_ = library_name_;
+        tmp.library_id_ = library_id_;
         if (interface_) tmp.interface_ = interface_;
         else tmp.interface_ = weak_interface_.lock();
         return tmp;
@@ -146,21 +364,39 @@ public:
 public:
     template<typename... P>
     explicit Interface(const std::shared_ptr<DynamicLibrary>& library, const std::string& CreateInterface, const std::string& DestroyInterface, P... args)
-        : interface_(new Traits(library, CreateInterface, DestroyInterface, std::forward<P...>(args)...))
-        , library_name_(DynamicLibrary::GetLibraryName(library)){}
+        : interface_(std::make_shared<Traits>(library, CreateInterface, DestroyInterface, std::forward<P>(args)...))
+        , library_id_(DynamicLibrary::GetLibraryId(library)) {}
 
     void Reset(const std::shared_ptr<DynamicLibrary>& library, const std::string& CreateInterface, const std::string& DestroyInterface) {
-        interface_ = new Traits(library, CreateInterface, DestroyInterface);
-        library_name_ = DynamicLibrary::GetLibraryName(library);
+        interface_ = std::make_shared<Traits>(library, CreateInterface, DestroyInterface);
+        library_id_ = DynamicLibrary::GetLibraryId(library);
     }
 
     template<typename... P>
     void Reset(const std::shared_ptr<DynamicLibrary>& library, const std::string& CreateInterface, const std::string& DestroyInterface, P... args) {
-        interface_ = new Traits(library, CreateInterface, DestroyInterface, std::forward<P...>(args)...);
-        library_name_ = DynamicLibrary::GetLibraryName(library);
+        interface_ = std::make_shared<Traits>(library, CreateInterface, DestroyInterface, std::forward<P>(args)...);
+        library_id_ = DynamicLibrary::GetLibraryId(library);
     }
 
-    void Reset(NativeInterface* inter, const typename Traits::Destructor& destructor) { interface_ = new Traits(inter, destructor); }
+    template<typename... A, typename... D, typename... P>
+    explicit Interface(const std::shared_ptr<DynamicLibrary>& library, const Symbol<NativeInterface*, A...>& CreateInterface, const Symbol<void, D...>& DestroyInterface, P... args)
+        : interface_(std::make_shared<Traits>(library, CreateInterface, DestroyInterface, std::forward<P>(args)...))
+        , library_id_(DynamicLibrary::GetLibraryId(library)) {}
+
+    template<typename... A, typename... D, typename... P>
+    void Reset(const std::shared_ptr<DynamicLibrary>& library, const Symbol<NativeInterface*, A...>& CreateInterface, const Symbol<void, D...>& DestroyInterface, P... args) {
+        interface_ = std::make_shared<Traits>(library, CreateInterface, DestroyInterface, std::forward<P>(args)...);
+        library_id_ = DynamicLibrary::GetLibraryId(library);
+    }
+
+    void Reset(NativeInterface* inter, const typename Traits::Destructor& destructor) { interface_ = std::make_shared<Traits>(inter, destructor); }
+
+    // Adopts |inter|, given to |release| along with |owner| and |destroy| once
+    // the last reference goes, see NativeTraits::Release.
+    template<typename Owner, typename Destroy, typename Release>
+    void Reset(const std::shared_ptr<Owner>& owner, NativeInterface* inter, Destroy destroy, Release release) {
+        interface_ = std::make_shared<Traits>(std::shared_ptr<void>(owner), inter, destroy, release);
+    }
 
 public:
     operator bool() const { return !!get(); }
@@ -173,8 +409,12 @@ public:
     }
 
     NativeInterface* get() const {
-      if (!library_name_.empty() && !utils::WellKnownLibrary(library_name_))
-        return nullptr;
+        // Costs two atomic loads while no module has been unloaded since the
+        // last positive check, see internal::ModuleNames.
+        if (library_id_ != internal::kNoModule) {
+            internal::RecordLivenessCheck();
+            if (!internal::ModuleNames::GetInstance()->IsLoaded(library_id_)) return nullptr;
+        }
         if (interface_) return interface_->get();
         auto known_interface = weak_interface_.lock();
         if (known_interface) {
@@ -196,20 +436,116 @@ public:
         return _interface;
     }
 
-    void reset() { interface_ = nullptr; weak_interface_ = nullptr; library_name_ = L""; }
+    void reset() { interface_ = nullptr; weak_interface_.reset(); library_id_ = internal::kNoModule; }
 
-    void swap(Interface& r) { interface_.swap(r.interface_); weak_interface_.swap(r.weak_interface_); std::swap(libarary_name_, r.library_name_); }
+    void swap(Interface& r) {
+        interface_.swap(r.interface_);
+        weak_interface_.swap(r.weak_interface_);
+        std::swap(library_id_, r.library_id_);
+    }
 
-    void SetLibraryName(const std::wstring& name) { library_name_ = name; }
+    void SetLibraryName(const std::wstring& name) { library_id_ = internal::ModuleNames::GetInstance()->Intern(name); }
+
+    void SetLibraryId(internal::ModuleId id) { library_id_ = id; }
 
 protected:
     std::shared_ptr<Traits> interface_ = nullptr;
     std::weak_ptr<Traits> weak_interface_;
-    std::wstring library_name_;
+    internal::ModuleId library_id_ = internal::kNoModule;
     std::shared_ptr<subtle::ThreadFlag> flag_;
     std::weak_ptr<subtle::ThreadFlag> weak_flag_;
 };
 
+// A lean Interface for the objects whose library is known to outlive them:
+// the object and its destroy export, resolved upfront, and nothing else. It
+// neither holds the library nor checks it is still loaded, there is no
+// reference count and no virtual call, operator-> is a load. Move only.
+template<typename NativeInterface, typename DestructTraits = subtle::Pointer<NativeInterface>>
+class StrongInterface {
+public:
+    using Traits = subtle::NativeTraits<NativeInterface, DestructTraits>;
+    using DestroyFunction = typename Traits::DestroyFunction;
+
+    StrongInterface() {}
+
+    StrongInterface(NativeInterface* inter, DestroyFunction destroy)
+        : destroy_(destroy)
+        , interface_(inter) {}
+
+    // The destroy export is resolved first, without it no object is created.
+    template<typename... P>
+    explicit StrongInterface(const std::shared_ptr<DynamicLibrary>& library, const std::string& CreateInterface, const std::string& DestroyInterface, P&&... args)
+        : destroy_(Traits::ResolveDestroy(library, DestroyInterface))
+        , interface_(destroy_ ? Traits::template Contruct<typename std::decay<P>::type...>(library, CreateInterface, std::forward<P>(args)...) : nullptr) {}
+
+    template<typename... A, typename... D, typename... P>
+    explicit StrongInterface(const std::shared_ptr<DynamicLibrary>& library, const Symbol<NativeInterface*, A...>& CreateInterface, const Symbol<void, D...>& DestroyInterface, P&&... args)
+        : destroy_(Traits::ResolveDestroy(library, DestroyInterface))
+        , interface_(destroy_ ? Traits::Contruct(library, CreateInterface, std::forward<P>(args)...) : nullptr) {}
+
+    StrongInterface(StrongInterface&& r) : destroy_(r.destroy_), interface_(r.interface_) { r.interface_ = nullptr; }
+
+    StrongInterface& operator=(StrongInterface&& r) {
+        if (this == &r) return *this;
+        reset();
+        interface_ = r.interface_;
+        destroy_ = r.destroy_;
+        r.interface_ = nullptr;
+        return *this;
+    }
+
+    ~StrongInterface() { reset(); }
+
+    // Hands the object over to an Interface, leaving this one empty. The
+    // Interface doesn't track the library either.
+    Interface<NativeInterface, Traits> AsRefPtr() {
+        Interface<NativeInterface, Traits> result;
+        if (!interface_) return result;
+        auto destroy = destroy_;
+        result.Reset(std::shared_ptr<void>(), release(), destroy, &Traits::DestroyRelease);
+        return result;
+    }
+
+    explicit operator bool() const { return interface_ != nullptr; }
+
+    bool operator!() const { return interface_ == nullptr; }
+
+    NativeInterface* get() const { return interface_; }
+
+    NativeInterface* operator->() const {
+        assert(interface_ != nullptr);
+        return interface_;
+    }
+
+    NativeInterface& operator*() const {
+        assert(interface_ != nullptr);
+        return *interface_;
+    }
+
+    // Returns the object, which the caller has to destroy.
+    NativeInterface* release() {
+        NativeInterface* result = interface_;
+        interface_ = nullptr;
+        return result;
+    }
+
+    void reset() {
+        NativeInterface* inter = release();
+        if (inter && destroy_) DestructTraits::Destroy(destroy_, inter);
+    }
+
+    void swap(StrongInterface& r) {
+        std::swap(interface_, r.interface_);
+        std::swap(destroy_, r.destroy_);
+    }
+
+private:
+    // Declared first, the constructors resolve it before creating the object.
+    DestroyFunction destroy_ = nullptr;
+    NativeInterface* interface_ = nullptr;
+    DISALLOW_COPY_AND_ASSIGN(StrongInterface);
+};
+
 template<typename R, typename... P>
 class Function {
 public:
@@ -218,20 +554,63 @@ public:
     explicit Function(const std::shared_ptr<DynamicLibrary>& library, std::string name) {
         Reset(library, name);
     }
+    explicit Function(const std::shared_ptr<DynamicLibrary>& library, const Symbol<R, P...>& symbol) {
+        Reset(library, symbol);
+    }
+    Function(const Function& r) { *this = r; }
+    Function(Function&& r) noexcept { *this = std::move(r); }
     virtual ~Function() { reset(); }
 
+    Function& operator=(const Function& r) {
+        library_ = r.library_;
+        name_ = r.name_;
+        symbol_ = r.symbol_;
+        function_ = r.function_;
+        batch_.store(r.batch_.load(std::memory_order_acquire), std::memory_order_release);
+        return *this;
+    }
+
+    // Leaves |r| unbound.
+    Function& operator=(Function&& r) noexcept {
+        if (this == &r) return *this;
+        library_ = std::move(r.library_);
+        name_ = std::move(r.name_);
+        symbol_ = r.symbol_;
+        function_ = r.function_;
+        batch_.store(r.batch_.load(std::memory_order_acquire), std::memory_order_release);
+        r.reset();
+        return *this;
+    }
+
     void Reset(const std::string& name) { Reset(library_, name); }
 
-    void Reset(const std::shared_ptr<DynamicLibrary>& library) { Reset(library, name_); }
+    void Reset(const std::shared_ptr<DynamicLibrary>& library) {
+        if (symbol_.name()) Reset(library, symbol_);
+        else Reset(library, name_);
+    }
 
     void Reset(const std::shared_ptr<DynamicLibrary>& library, const std::string& name) {
         library_ = library;
         name_ = name;
+        symbol_ = Symbol<R, P...>();
+        batch_.store(nullptr, std::memory_order_release);
         if (!library || name.empty()) return;
         function_ = utils::GetFunctionPointer<R, P...>(library, name);
         if (!function_) library_ = nullptr;
     }
 
+    // Keeps |symbol| rather than its name, resolving it again hashes and
+    // allocates nothing.
+    void Reset(const std::shared_ptr<DynamicLibrary>& library, const Symbol<R, P...>& symbol) {
+        library_ = library;
+        name_.clear();
+        symbol_ = symbol;
+        batch_.store(nullptr, std::memory_order_release);
+        if (!library) return;
+        function_ = library->GetFunctionPointer(symbol);
+        if (!function_) library_ = nullptr;
+    }
+
     Function& operator=(std::nullptr_t) {
         reset();
         return *this;
@@ -241,14 +620,49 @@ public:
 
     bool operator!() const { return !get(); }
 
-    R operator()(P&&... args) {
+    R operator()(P... args) {
         assert(function_ != nullptr && library_ != nullptr);
         return function_(std::forward<P>(args)...);
     }
 
-    void reset() { library_ = nullptr; function_ = nullptr; name_ = ""; }
+    // Calls the function on each of the |count| |args|, storing what it
+    // returns into |results|. Goes through the library's Name_batch export
+    // when it has one, see subtle::BatchTraits, so that the plugin may
+    // vectorize over the span, and loops over the function otherwise.
+    // Functions of a single argument only.
+    template<typename Traits = subtle::BatchTraits<R, P...>>
+    void CallBatch(const typename Traits::Argument* args, size_t count, typename Traits::Result* results) {
+        assert(function_ != nullptr && library_ != nullptr);
+        assert(results != nullptr || std::is_void<R>::value || count == 0);
+        auto batch = GetBatch<Traits>();
+        if constexpr (std::is_void<R>::value) {
+            if (batch) return batch(args, count);
+            for (size_t i = 0; i < count; ++i) function_(args[i]);
+        } else {
+            if (batch) return batch(args, count, results);
+            for (size_t i = 0; i < count; ++i) results[i] = function_(args[i]);
+        }
+    }
 
-    void swap(Function& r) { library_.swap(r.library_); weak_library_.swap(r.weak_library_); std::swap(name_, r.name_); std::swap(function_, r.function_); }
+    // Same for void functions, which have no results to store.
+    template<typename Traits = subtle::BatchTraits<R, P...>>
+    void CallBatch(const typename Traits::Argument* args, size_t count) {
+        static_assert(std::is_void<R>::value, "CallBatch() stores the results of a non void function");
+        CallBatch<Traits>(args, count, nullptr);
+    }
+
+    void reset() {
+        library_ = nullptr; function_ = nullptr; name_ = ""; symbol_ = Symbol<R, P...>();
+        batch_.store(nullptr, std::memory_order_release);
+    }
+
+    void swap(Function& r) {
+        library_.swap(r.library_);
+        std::swap(name_, r.name_);
+        std::swap(symbol_, r.symbol_);
+        std::swap(function_, r.function_);
+        batch_.store(r.batch_.exchange(batch_.load(std::memory_order_acquire), std::memory_order_acq_rel), std::memory_order_release);
+    }
 
 protected:
     typename FunctorTraits<R, P...>::Type get() const {
@@ -256,9 +670,140 @@ protected:
         return nullptr;
     }
 
+    // The name of the export bound, by string or by symbol.
+    const char* name() const { return symbol_.name() ? symbol_.name() : name_.c_str(); }
+
+    // The Name_batch export, looked up by the first batched call, nullptr
+    // when the library has none. Threads racing on it store the same value.
+    template<typename Traits>
+    typename Traits::Type GetBatch() const {
+        using Type = typename Traits::Type;
+        auto batch = batch_.load(std::memory_order_acquire);
+        if (batch == NoBatch()) return nullptr;
+        if (batch) return reinterpret_cast<Type>(batch);
+        Type function = Traits::Resolve(*library_, std::string(name()) + "_batch");
+        batch_.store(function ? reinterpret_cast<void*>(function) : NoBatch(), std::memory_order_release);
+        return function;
+    }
+
+    // Marks the batch export as missing.
+    static void* NoBatch() {
+        static char none;
+        return &none;
+    }
+
     std::shared_ptr<DynamicLibrary> library_;
+    // Only one of them is set.
     std::string name_;
+    Symbol<R, P...> symbol_;
     typename FunctorTraits<R, P...>::Type function_ = nullptr;
+    mutable std::atomic<void*> batch_{nullptr};
+};
+
+// Same as Function, but the export is resolved by the first call rather than
+// by Reset(), so the entry points never called cost nothing at startup. Once
+// bound, a call is an atomic load and an indirect call.
+template<typename R, typename... P>
+class LazyFunction {
+public:
+    using Type = typename FunctorTraits<R, P...>::Type;
+
+    explicit LazyFunction() {}
+    explicit LazyFunction(const std::shared_ptr<DynamicLibrary>& library, std::string name) {
+        Reset(library, name);
+    }
+    explicit LazyFunction(const std::shared_ptr<DynamicLibrary>& library, const Symbol<R, P...>& symbol) {
+        Reset(library, symbol);
+    }
+    LazyFunction(const LazyFunction& r) { *this = r; }
+    LazyFunction(LazyFunction&& r) noexcept { *this = std::move(r); }
+    virtual ~LazyFunction() { reset(); }
+
+    LazyFunction& operator=(const LazyFunction& r) {
+        library_ = r.library_;
+        name_ = r.name_;
+        symbol_ = r.symbol_;
+        function_.store(r.function_.load(std::memory_order_acquire), std::memory_order_release);
+        return *this;
+    }
+
+    // Leaves |r| unbound.
+    LazyFunction& operator=(LazyFunction&& r) noexcept {
+        if (this == &r) return *this;
+        library_ = std::move(r.library_);
+        name_ = std::move(r.name_);
+        symbol_ = r.symbol_;
+        function_.store(r.function_.load(std::memory_order_acquire), std::memory_order_release);
+        r.reset();
+        return *this;
+    }
+
+    void Reset(const std::string& name) { Reset(library_, name); }
+
+    void Reset(const std::shared_ptr<DynamicLibrary>& library) {
+        if (symbol_.name()) Reset(library, symbol_);
+        else Reset(library, name_);
+    }
+
+    void Reset(const std::shared_ptr<DynamicLibrary>& library, const std::string& name) {
+        library_ = library;
+        name_ = name;
+        symbol_ = Symbol<R, P...>();
+        function_.store(nullptr, std::memory_order_release);
+    }
+
+    // Keeps |symbol| rather than its name, the first call hashes and
+    // allocates nothing.
+    void Reset(const std::shared_ptr<DynamicLibrary>& library, const Symbol<R, P...>& symbol) {
+        library_ = library;
+        name_.clear();
+        symbol_ = symbol;
+        function_.store(nullptr, std::memory_order_release);
+    }
+
+    LazyFunction& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    // Resolves the export to answer.
+    operator bool() const { return !!get(); }
+
+    bool operator!() const { return !get(); }
+
+    R operator()(P... args) {
+        auto function = get();
+        assert(function != nullptr);
+        return function(std::forward<P>(args)...);
+    }
+
+    void reset() {
+        library_ = nullptr; function_.store(nullptr, std::memory_order_release); name_ = ""; symbol_ = Symbol<R, P...>();
+    }
+
+protected:
+    Type get() const {
+        auto function = function_.load(std::memory_order_acquire);
+        if (function) return function;
+        return Bind();
+    }
+
+    // Threads racing on the first call resolve the same address, the cache of
+    // the library makes the losers cheap.
+    Type Bind() const {
+        if (!library_) return nullptr;
+        Type function = nullptr;
+        if (symbol_.name()) function = library_->GetFunctionPointer(symbol_);
+        else if (!name_.empty()) function = library_->GetFunctionPointer<R, P...>(name_);
+        if (function) function_.store(function, std::memory_order_release);
+        return function;
+    }
+
+    std::shared_ptr<DynamicLibrary> library_;
+    // Only one of them is set.
+    std::string name_;
+    Symbol<R, P...> symbol_;
+    mutable std::atomic<Type> function_{nullptr};
 };
 
 } // namespace utils
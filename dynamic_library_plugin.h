@@ -0,0 +1,194 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef UTILS_DYNAMIC_LIBRARY_PLUGIN_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_PLUGIN_INCLUDE_H_
+
+// The plugin side of the ABI descriptor read by DynamicLibrary::LoadManifest().
+// Included by the plugins themselves, so it depends on nothing but <cstdint>.
+//
+//   struct Foo;
+//   UTILS_PLUGIN_DECLARE_TYPE(Foo)
+//
+//   Foo* UTILS_LIBRARY_CALL CreateFoo(int x);
+//   void UTILS_LIBRARY_CALL DestroyFoo(Foo* foo);
+//
+//   UTILS_PLUGIN_MANIFEST(UTILS_PLUGIN_EXPORT(CreateFoo),
+//                         UTILS_PLUGIN_EXPORT_VERSION(DestroyFoo, 2))
+
+#include <cstdint>
+
+#if !defined(UTILS_LIBRARY_CALL)
+#if defined(_WIN32)
+#define UTILS_LIBRARY_CALL __stdcall
+#else
+#define UTILS_LIBRARY_CALL
+#endif
+#endif
+
+#if defined(_WIN32)
+#define UTILS_PLUGIN_API extern "C" __declspec(dllexport)
+#else
+#define UTILS_PLUGIN_API extern "C" __attribute__((visibility("default")))
+#endif
+
+namespace internal {
+
+const uint64_t kSignatureBasis = 14695981039346656037ull;
+const uint64_t kSignaturePrime = 1099511628211ull;
+
+// FNV-1a of a type's name, never 0.
+constexpr uint64_t HashTypeName(const char* name) {
+  uint64_t hash = kSignatureBasis;
+  for (; *name != '\0'; ++name) {
+    hash ^= static_cast<uint8_t>(*name);
+    hash *= kSignaturePrime;
+  }
+  return hash ? hash : 1;
+}
+
+// Folds |code| into |hash| byte by byte, 0 stays 0.
+constexpr uint64_t MixSignature(uint64_t hash, uint64_t code) {
+  if (hash == 0 || code == 0) return 0;
+  for (int i = 0; i < 8; ++i) {
+    hash ^= (code >> (i * 8)) & 0xff;
+    hash *= kSignaturePrime;
+  }
+  return hash ? hash : 1;
+}
+
+// The code of a parameter or return type, the same in every module built for
+// the platform. 0, for the types nobody declared, leaves the signatures using
+// them unchecked.
+template<typename T>
+struct SignatureCode { static constexpr uint64_t value = 0; };
+
+template<typename T>
+struct SignatureCode<const T> {
+  static constexpr uint64_t value = MixSignature(SignatureCode<T>::value, 'C');
+};
+
+template<typename T>
+struct SignatureCode<volatile T> {
+  static constexpr uint64_t value = MixSignature(SignatureCode<T>::value, 'V');
+};
+
+template<typename T>
+struct SignatureCode<const volatile T> {
+  static constexpr uint64_t value = MixSignature(SignatureCode<volatile T>::value, 'C');
+};
+
+template<typename T>
+struct SignatureCode<T*> {
+  static constexpr uint64_t value = MixSignature(SignatureCode<T>::value, 'P');
+};
+
+template<typename T>
+struct SignatureCode<T&> {
+  static constexpr uint64_t value = MixSignature(SignatureCode<T>::value, 'R');
+};
+
+template<typename T>
+struct SignatureCode<T&&> {
+  static constexpr uint64_t value = MixSignature(SignatureCode<T>::value, 'Q');
+};
+
+// The hash of R(P...), 0 when one of its types has no code.
+template<typename R, typename... P>
+constexpr uint64_t SignatureOf() {
+  const uint64_t codes[] = {SignatureCode<R>::value, SignatureCode<P>::value...};
+  uint64_t hash = kSignatureBasis;
+  for (uint64_t code : codes) hash = MixSignature(hash, code);
+  return hash;
+}
+
+template<typename R, typename... P>
+constexpr uint64_t SignatureOf(R (UTILS_LIBRARY_CALL*)(P...)) {
+  return SignatureOf<R, P...>();
+}
+
+}  // namespace internal
+
+// Gives |type| a signature code, from its name. At global scope, and before
+// any signature using it is hashed.
+#define UTILS_PLUGIN_DECLARE_TYPE(type)                                      \
+  template<>                                                                 \
+  struct internal::SignatureCode<type> {                                     \
+    static constexpr uint64_t value = ::internal::HashTypeName(#type);       \
+  };
+
+UTILS_PLUGIN_DECLARE_TYPE(void)
+UTILS_PLUGIN_DECLARE_TYPE(bool)
+UTILS_PLUGIN_DECLARE_TYPE(char)
+UTILS_PLUGIN_DECLARE_TYPE(signed char)
+UTILS_PLUGIN_DECLARE_TYPE(unsigned char)
+UTILS_PLUGIN_DECLARE_TYPE(wchar_t)
+UTILS_PLUGIN_DECLARE_TYPE(char16_t)
+UTILS_PLUGIN_DECLARE_TYPE(char32_t)
+UTILS_PLUGIN_DECLARE_TYPE(short)
+UTILS_PLUGIN_DECLARE_TYPE(unsigned short)
+UTILS_PLUGIN_DECLARE_TYPE(int)
+UTILS_PLUGIN_DECLARE_TYPE(unsigned int)
+UTILS_PLUGIN_DECLARE_TYPE(long)
+UTILS_PLUGIN_DECLARE_TYPE(unsigned long)
+UTILS_PLUGIN_DECLARE_TYPE(long long)
+UTILS_PLUGIN_DECLARE_TYPE(unsigned long long)
+UTILS_PLUGIN_DECLARE_TYPE(float)
+UTILS_PLUGIN_DECLARE_TYPE(double)
+UTILS_PLUGIN_DECLARE_TYPE(long double)
+
+
+namespace utils {
+
+// Bumped whenever PluginExport or PluginManifest change layout.
+const uint32_t kPluginAbiVersion = 1;
+
+// The name of the export returning the plugin's PluginManifest.
+const char kPluginManifestExport[] = "GetPluginManifest";
+
+struct PluginExport {
+    const char* name;
+    // internal::SignatureOf() the function, 0 when unchecked.
+    uint64_t signature;
+    void* function;
+    // The plugin's own version of the function, for the host to tell
+    // revisions of one signature apart.
+    uint32_t version;
+};
+
+struct PluginManifest {
+    uint32_t abi_version;
+    uint32_t count;
+    const PluginExport* exports;
+};
+
+typedef const PluginManifest* (UTILS_LIBRARY_CALL *GetPluginManifestFunction)();
+
+} // namespace utils
+
+#define UTILS_PLUGIN_EXPORT_VERSION(function, version)                       \
+  utils::PluginExport{#function, ::internal::SignatureOf(&function),         \
+                      reinterpret_cast<void*>(&function), version}
+
+#define UTILS_PLUGIN_EXPORT(function) UTILS_PLUGIN_EXPORT_VERSION(function, 1)
+
+// Defines the GetPluginManifest export listing the given UTILS_PLUGIN_EXPORT()s.
+// The functions need not be exported themselves.
+#define UTILS_PLUGIN_MANIFEST(...)                                           \
+  UTILS_PLUGIN_API const utils::PluginManifest* UTILS_LIBRARY_CALL           \
+  GetPluginManifest() {                                                      \
+    static const utils::PluginExport exports[] = {__VA_ARGS__};              \
+    static const utils::PluginManifest manifest = {                          \
+        utils::kPluginAbiVersion,                                            \
+        static_cast<uint32_t>(sizeof(exports) / sizeof(exports[0])),         \
+        exports};                                                            \
+    return &manifest;                                                        \
+  }
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_PLUGIN_INCLUDE_H_
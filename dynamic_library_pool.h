@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef UTILS_DYNAMIC_LIBRARY_POOL_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_POOL_INCLUDE_H_
+
+#include <tuple>
+#include <vector>
+
+#include "dynamic_library_interface.h"
+
+namespace utils {
+
+// Recycles the native objects of one interface type created by one library.
+// Acquire() hands out an Interface whose destruction gives the object back to
+// the pool rather than to the destroy export, so that a warm pool serves a
+// request with neither the create nor the destroy export nor the plugin's
+// allocator. Objects given back go through the optional reset export, void
+// ResetInterface(NativeInterface*), and are kept in one of a few freelists
+// picked by thread, up to |max_idle| objects each.
+//
+//   utils::InterfacePool<Foo> pool(library, "CreateFoo", "DestroyFoo", "ResetFoo", 16, 42);
+//   auto foo = pool.Acquire();
+//
+// Every object is created with the arguments given to the pool. The library
+// stays loaded as long as the pool or one of its objects is alive.
+template<typename NativeInterface, typename DestructTraits = subtle::Pointer<NativeInterface>>
+class InterfacePool {
+public:
+    using Traits = subtle::NativeTraits<NativeInterface, DestructTraits>;
+    using Handle = Interface<NativeInterface, Traits>;
+    using ResetFunction = typename FunctorTraits<void, NativeInterface*>::Type;
+
+    template<typename... P>
+    explicit InterfacePool(const std::shared_ptr<DynamicLibrary>& library, const std::string& CreateInterface, const std::string& DestroyInterface,
+                           const std::string& ResetInterface, size_t max_idle, P... args)
+        : state_(std::make_shared<State>()) {
+        state_->library = library;
+        state_->max_idle = max_idle;
+        if (!library) return;
+        state_->destroy = Traits::ResolveDestroy(library, DestroyInterface);
+        if (!ResetInterface.empty()) state_->reset = library->GetFunctionPointer<void, NativeInterface*>(ResetInterface);
+        auto create = Traits::template ResolveCreate<P...>(library, CreateInterface);
+        if (!create || !state_->destroy) return;
+        auto arguments = std::make_tuple(args...);
+        state_->create = [create, arguments] { return std::apply(create, arguments); };
+    }
+
+    // Objects still checked out are destroyed once given back.
+    virtual ~InterfacePool() {
+        state_->closed.store(true, std::memory_order_release);
+        state_->Clear();
+    }
+
+    bool is_valid() const { return !!state_->create; }
+
+    // Returns an idle object, or a new one. Empty when the object can't be
+    // created.
+    Handle Acquire() {
+        Handle result;
+        auto inter = state_->Take();
+        if (!inter) return result;
+        result.Reset(state_, inter, state_->destroy, &State::Release);
+        result.SetLibraryId(DynamicLibrary::GetLibraryId(state_->library));
+        return result;
+    }
+
+    // Destroys the idle objects.
+    void Clear() { state_->Clear(); }
+
+    size_t idle() const { return state_->idle(); }
+
+private:
+    static const size_t kShards = 8;
+
+    struct alignas(64) Shard {
+        std::mutex lock;
+        std::vector<NativeInterface*> idle;
+    };
+
+    // Shared with the handles checked out, which may outlive the pool.
+    struct State {
+        ~State() { Clear(); }
+
+        NativeInterface* Take() {
+            auto& shard = shards[internal::ThreadSlot() % kShards];
+            {
+                std::lock_guard<std::mutex> guard(shard.lock);
+                if (!shard.idle.empty()) {
+                    auto inter = shard.idle.back();
+                    shard.idle.pop_back();
+                    return inter;
+                }
+            }
+            if (!create) return nullptr;
+            return create();
+        }
+
+        // The Traits::Release giving the objects of a Handle back.
+        static void Release(void* owner, typename Traits::DestroyFunction /* destroy */, NativeInterface* inter) {
+            static_cast<State*>(owner)->Give(inter);
+        }
+
+        void Give(NativeInterface* inter) {
+            if (!inter) return;
+            if (!closed.load(std::memory_order_acquire)) {
+                if (reset) reset(inter);
+                auto& shard = shards[internal::ThreadSlot() % kShards];
+                std::lock_guard<std::mutex> guard(shard.lock);
+                if (shard.idle.size() < max_idle) {
+                    shard.idle.push_back(inter);
+                    return;
+                }
+            }
+            DestructTraits::Destroy(destroy, inter);
+        }
+
+        void Clear() {
+            for (auto& shard : shards) {
+                std::vector<NativeInterface*> idle;
+                {
+                    std::lock_guard<std::mutex> guard(shard.lock);
+                    idle.swap(shard.idle);
+                }
+                for (auto inter : idle) DestructTraits::Destroy(destroy, inter);
+            }
+        }
+
+        size_t idle() {
+            size_t result = 0;
+            for (auto& shard : shards) {
+                std::lock_guard<std::mutex> guard(shard.lock);
+                result += shard.idle.size();
+            }
+            return result;
+        }
+
+        std::shared_ptr<DynamicLibrary> library;
+        std::function<NativeInterface*()> create;
+        typename Traits::DestroyFunction destroy = nullptr;
+        ResetFunction reset = nullptr;
+        size_t max_idle = 0;
+        std::atomic<bool> closed{false};
+        Shard shards[kShards];
+    };
+
+    std::shared_ptr<State> state_;
+    DISALLOW_COPY_AND_ASSIGN(InterfacePool);
+};
+
+} // namespace utils
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_POOL_INCLUDE_H_
@@ -0,0 +1,137 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef UTILS_DYNAMIC_LIBRARY_PRELOADER_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_PRELOADER_INCLUDE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "dynamic_library.h"
+
+namespace internal {
+
+// A fixed number of threads running the posted tasks in FIFO order. The
+// destructor runs the pending tasks before joining the threads.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t threads) {
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; ++i) {
+      threads_.emplace_back([this] { Run(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      stopping_ = true;
+    }
+    wakeup_.notify_all();
+    for (auto& thread : threads_) thread.join();
+  }
+
+  void Post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      tasks_.push_back(std::move(task));
+    }
+    wakeup_.notify_one();
+  }
+
+  size_t size() const { return threads_.size(); }
+
+ private:
+  void Run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> guard(lock_);
+        wakeup_.wait(guard, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex lock_;
+  std::condition_variable wakeup_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+  DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace internal
+
+
+namespace utils {
+
+struct PreloadRequest {
+    std::wstring path;
+    // Resolved ahead of time into the library's symbol cache, the load fails
+    // when one of them is missing.
+    std::vector<std::string> exports;
+    // How the library is loaded, unless someone already holds it.
+    LoadOptions options;
+};
+
+// Loads independent libraries in parallel on a bounded number of threads.
+// Every request gets its own future, holding nullptr when the library or one
+// of its exports could not be loaded.
+class LibraryPreloader {
+public:
+    using Future = std::shared_future<std::shared_ptr<DynamicLibrary>>;
+
+    // |max_threads| 0 uses one thread per hardware thread.
+    explicit LibraryPreloader(size_t max_threads = 0)
+        : pool_(max_threads ? max_threads : std::thread::hardware_concurrency()) {}
+
+    // Waits for the pending loads.
+    virtual ~LibraryPreloader() {}
+
+    Future Preload(const PreloadRequest& request) {
+        auto task = std::make_shared<std::packaged_task<std::shared_ptr<DynamicLibrary>()>>(
+            [request] { return LibraryPreloader::Load(request); });
+        Future result = task->get_future().share();
+        pool_.Post([task] { (*task)(); });
+        return result;
+    }
+
+    std::vector<Future> Preload(const std::vector<PreloadRequest>& manifest) {
+        std::vector<Future> result;
+        result.reserve(manifest.size());
+        for (const auto& request : manifest) result.push_back(Preload(request));
+        return result;
+    }
+
+    // Loads |request| on the calling thread, through the LibraryRegistry so
+    // that the later users of the library share the resolved exports.
+    static std::shared_ptr<DynamicLibrary> Load(const PreloadRequest& request) {
+        auto library = LibraryRegistry::GetInstance()->Open(request.path, request.options);
+        if (!library) return nullptr;
+        for (const auto& name : request.exports) {
+            if (!library->GetFunctionPointer(name.c_str())) return nullptr;
+        }
+        return library;
+    }
+
+private:
+    internal::WorkerPool pool_;
+    DISALLOW_COPY_AND_ASSIGN(LibraryPreloader);
+};
+
+} // namespace utils
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_PRELOADER_INCLUDE_H_
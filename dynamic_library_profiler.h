@@ -0,0 +1,286 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef UTILS_DYNAMIC_LIBRARY_PROFILER_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_PROFILER_INCLUDE_H_
+
+#include <string>
+#include <vector>
+
+#include "dynamic_library_interface.h"
+
+#if defined(UTILS_FUNCTION_PROFILING)
+#include <deque>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+#endif
+
+namespace utils {
+
+// What the calls through the ProfiledFunction objects bound to one export
+// cost. Only one call in ProfileBuffer::kSampleRate per thread is timed.
+struct FunctionProfile {
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t sampled_calls = 0;
+    uint64_t sampled_ns = 0;
+    // Time stamp counter ticks, 0 where there is none.
+    uint64_t sampled_cycles = 0;
+
+    // The wall time of all the calls, extrapolated from the sampled ones.
+    uint64_t estimated_total_ns() const {
+        if (sampled_calls == 0) return 0;
+        return static_cast<uint64_t>(static_cast<double>(sampled_ns) * calls / sampled_calls);
+    }
+};
+
+} // namespace utils
+
+#if defined(UTILS_FUNCTION_PROFILING)
+
+namespace internal {
+
+inline uint64_t ReadCycleCounter() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// The counters of one thread, written by that thread alone, so that counting
+// a call is a plain load and store, and read by the profiler from any thread.
+// Sites are the exports profiled, numbered by the FunctionProfiler.
+class ProfileBuffer {
+ public:
+  static const uint32_t kSampleRate = 64;
+  static const uint32_t kChunkSize = 64;
+  static const uint32_t kMaxSites = 64 * kChunkSize;
+
+  struct Counters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> sampled_calls{0};
+    std::atomic<uint64_t> sampled_ns{0};
+    std::atomic<uint64_t> sampled_cycles{0};
+  };
+
+  ProfileBuffer() {}
+
+  ~ProfileBuffer() {
+    for (auto& chunk : chunks_) delete chunk.load(std::memory_order_relaxed);
+  }
+
+  // Owner thread only. nullptr past kMaxSites.
+  Counters* At(uint32_t site) {
+    if (site >= kMaxSites) return nullptr;
+    auto& slot = chunks_[site / kChunkSize];
+    Chunk* chunk = slot.load(std::memory_order_relaxed);
+    if (!chunk) {
+      chunk = new Chunk;
+      slot.store(chunk, std::memory_order_release);
+    }
+    return &chunk->sites[site % kChunkSize];
+  }
+
+  // Any thread.
+  const Counters* Find(uint32_t site) const {
+    if (site >= kMaxSites) return nullptr;
+    Chunk* chunk = chunks_[site / kChunkSize].load(std::memory_order_acquire);
+    if (!chunk) return nullptr;
+    return &chunk->sites[site % kChunkSize];
+  }
+
+  // Owner thread only, tells whether to time the next call.
+  bool Sample() { return ++calls_ % kSampleRate == 0; }
+
+ private:
+  struct Chunk {
+    Counters sites[kChunkSize];
+  };
+
+  std::atomic<Chunk*> chunks_[kMaxSites / kChunkSize] = {};
+  uint32_t calls_ = 0;
+  DISALLOW_COPY_AND_ASSIGN(ProfileBuffer);
+};
+
+// Numbers the profiled exports and owns the buffers of every thread. The
+// buffer of an exited thread is handed to the next new one, the counts it
+// holds belong to the sites rather than the thread.
+class FunctionProfiler {
+ public:
+  // Leaked, threads may still call while the process goes down.
+  static FunctionProfiler* GetInstance() {
+    static FunctionProfiler* instance = new FunctionProfiler();
+    return instance;
+  }
+
+  // Returns the site of the export |name| at |address|.
+  uint32_t Register(const std::string& name, const void* address) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = sites_.find(address);
+    if (it != sites_.end()) return it->second;
+    auto site = static_cast<uint32_t>(names_.size());
+    names_.push_back(name);
+    sites_.emplace(address, site);
+    return site;
+  }
+
+  // The buffer of the calling thread.
+  static ProfileBuffer* CurrentBuffer() {
+    thread_local Lease lease;
+    return lease.buffer;
+  }
+
+  std::vector<utils::FunctionProfile> Snapshot() {
+    std::lock_guard<std::mutex> guard(lock_);
+    std::vector<utils::FunctionProfile> result(names_.size());
+    for (uint32_t site = 0; site < names_.size(); ++site) {
+      auto& profile = result[site];
+      profile.name = names_[site];
+      for (const auto& buffer : buffers_) {
+        auto counters = buffer->Find(site);
+        if (!counters) continue;
+        profile.calls += counters->calls.load(std::memory_order_relaxed);
+        profile.sampled_calls += counters->sampled_calls.load(std::memory_order_relaxed);
+        profile.sampled_ns += counters->sampled_ns.load(std::memory_order_relaxed);
+        profile.sampled_cycles += counters->sampled_cycles.load(std::memory_order_relaxed);
+      }
+    }
+    return result;
+  }
+
+ private:
+  struct Lease {
+    Lease() : buffer(FunctionProfiler::GetInstance()->Acquire()) {}
+    ~Lease() { FunctionProfiler::GetInstance()->Recycle(buffer); }
+    ProfileBuffer* buffer;
+  };
+
+  FunctionProfiler() {}
+
+  ProfileBuffer* Acquire() {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!free_.empty()) {
+      auto buffer = free_.back();
+      free_.pop_back();
+      return buffer;
+    }
+    buffers_.emplace_back(new ProfileBuffer);
+    return buffers_.back().get();
+  }
+
+  void Recycle(ProfileBuffer* buffer) {
+    std::lock_guard<std::mutex> guard(lock_);
+    free_.push_back(buffer);
+  }
+
+  std::mutex lock_;
+  std::deque<std::string> names_;
+  std::unordered_map<const void*, uint32_t> sites_;
+  std::vector<std::unique_ptr<ProfileBuffer>> buffers_;
+  std::vector<ProfileBuffer*> free_;
+  DISALLOW_COPY_AND_ASSIGN(FunctionProfiler);
+};
+
+// Counts one call on |site|, and times it when sampled.
+class ProfileScope {
+ public:
+  explicit ProfileScope(uint32_t site) {
+    auto buffer = FunctionProfiler::CurrentBuffer();
+    counters_ = buffer->At(site);
+    if (!counters_) return;
+    Bump(counters_->calls, 1);
+    if (!buffer->Sample()) {
+      counters_ = nullptr;
+      return;
+    }
+    start_ = std::chrono::steady_clock::now();
+    start_cycles_ = ReadCycleCounter();
+  }
+
+  ~ProfileScope() {
+    if (!counters_) return;
+    auto cycles = ReadCycleCounter() - start_cycles_;
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    Bump(counters_->sampled_calls, 1);
+    Bump(counters_->sampled_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    Bump(counters_->sampled_cycles, cycles);
+  }
+
+ private:
+  // A single writer needs no read-modify-write.
+  static void Bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+
+  ProfileBuffer::Counters* counters_ = nullptr;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t start_cycles_ = 0;
+  DISALLOW_COPY_AND_ASSIGN(ProfileScope);
+};
+
+}  // namespace internal
+
+#endif  // defined(UTILS_FUNCTION_PROFILING)
+
+
+namespace utils {
+
+#if defined(UTILS_FUNCTION_PROFILING)
+// A Function counting its calls and timing one in ProfileBuffer::kSampleRate
+// of them, see GetFunctionProfiles(). Built without UTILS_FUNCTION_PROFILING,
+// it is a plain Function.
+template<typename R, typename... P>
+class ProfiledFunction : public Function<R, P...> {
+public:
+    using Function<R, P...>::Function;
+
+    R operator()(P... args) {
+        auto function = this->get();
+        assert(function != nullptr);
+        internal::ProfileScope scope(Site(function));
+        return function(std::forward<P>(args)...);
+    }
+
+private:
+    using Type = typename FunctorTraits<R, P...>::Type;
+
+    // Registered on the first call after binding, rather than by Reset()
+    // which Function doesn't let us override.
+    uint32_t Site(Type function) {
+        if (function != site_function_) {
+            site_ = internal::FunctionProfiler::GetInstance()->Register(this->name(), reinterpret_cast<const void*>(function));
+            site_function_ = function;
+        }
+        return site_;
+    }
+
+    Type site_function_ = nullptr;
+    uint32_t site_ = 0;
+};
+
+// The profile of every export called through a ProfiledFunction so far.
+inline std::vector<FunctionProfile> GetFunctionProfiles() {
+    return internal::FunctionProfiler::GetInstance()->Snapshot();
+}
+#else  // defined(UTILS_FUNCTION_PROFILING)
+template<typename R, typename... P>
+using ProfiledFunction = Function<R, P...>;
+
+inline std::vector<FunctionProfile> GetFunctionProfiles() {
+    return std::vector<FunctionProfile>();
+}
+#endif  // defined(UTILS_FUNCTION_PROFILING)
+
+} // namespace utils
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_PROFILER_INCLUDE_H_
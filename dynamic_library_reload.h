@@ -0,0 +1,179 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef UTILS_DYNAMIC_LIBRARY_RELOAD_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_RELOAD_INCLUDE_H_
+
+#include <thread>
+#include <vector>
+
+#include "dynamic_library_interface.h"
+
+namespace internal {
+
+// Epoch based reclamation for one pointer, readers never wait nor lock.
+//
+// A reader counts itself in the current epoch, then checks that the epoch did
+// not move meanwhile. A writer publishes the new pointer, moves the epoch and
+// waits for the readers counted in the previous one before reclaiming. Readers
+// entering after the move see the new pointer.
+class EpochReaders {
+ public:
+  static const size_t kShards = 16;
+
+  // Where a reader counted itself.
+  struct Ticket {
+    uint64_t epoch;
+    size_t shard;
+  };
+
+  // Returns the ticket to be passed to Leave(), from any thread.
+  Ticket Enter() {
+    size_t index = ThreadSlot() % kShards;
+    auto& shard = shards_[index];
+    for (;;) {
+      uint64_t epoch = epoch_.load();
+      shard.readers[epoch & 1].fetch_add(1);
+      if (epoch_.load() == epoch) return Ticket{epoch, index};
+      shard.readers[epoch & 1].fetch_sub(1);
+    }
+  }
+
+  void Leave(const Ticket& ticket) {
+    shards_[ticket.shard].readers[ticket.epoch & 1].fetch_sub(1);
+  }
+
+  // Moves the epoch and waits for the readers who may still see what was
+  // published before this call. Two writers must not run it at once.
+  void Synchronize() {
+    uint64_t epoch = epoch_.fetch_add(1);
+    for (auto& shard : shards_) {
+      while (shard.readers[epoch & 1].load() != 0) std::this_thread::yield();
+    }
+  }
+
+ private:
+  // Leave() goes to the shard Enter() counted on, whichever thread leaves,
+  // so a shard's count never goes negative.
+  struct alignas(64) Shard {
+    std::atomic<int64_t> readers[2] = {{0}, {0}};
+  };
+
+  std::atomic<uint64_t> epoch_{0};
+  Shard shards_[kShards];
+};
+
+}  // namespace internal
+
+
+namespace utils {
+
+// A library which can be replaced while in use. Readers take a Reader on the
+// current generation, calls made through it keep running on that generation
+// while Reload() publishes the next one. The previous module is released once
+// its last reader has left.
+//
+// The loader hands out the module already mapped from a path, so each reload
+// has to come from another file, a versioned copy of the plugin for example.
+// The Interfaces made by Reader::CreateInterface() pin their generation's
+// module, other objects kept past their Reader have to hold
+// Reader::library().
+class ReloadableLibrary {
+public:
+    struct Generation {
+        std::shared_ptr<DynamicLibrary> library;
+        uint64_t version;
+    };
+
+    class Reader {
+    public:
+        explicit Reader(const ReloadableLibrary& owner)
+            : owner_(owner)
+            , ticket_(owner_.readers_.Enter())
+            , generation_(owner_.generation_.load()) {}
+        ~Reader() { owner_.readers_.Leave(ticket_); }
+
+        const std::shared_ptr<DynamicLibrary>& library() const { return generation_->library; }
+
+        uint64_t version() const { return generation_->version; }
+
+        template<typename R, typename... P>
+        typename FunctorTraits<R, P...>::Type GetFunctionPointer(const std::string& InterfaceName) const {
+            const auto& library = generation_->library;
+            if (!library) return nullptr;
+            return library->GetFunctionPointer<R, P...>(InterfaceName);
+        }
+
+        // The Interface holds the generation's library, so that the module
+        // stays mapped as long as the object, across Reload().
+        template<typename NativeInterface, typename Traits = subtle::PointerTraits<NativeInterface>, typename... P>
+        Interface<NativeInterface, Traits> CreateInterface(const std::string& CreateInterface, const std::string& DestroyInterface, P... args) const {
+            static_assert(Traits::kResolvesDestroy, "the Traits must resolve the destroy export");
+            Interface<NativeInterface, Traits> result;
+            const auto& library = generation_->library;
+            if (!library) return result;
+            auto destroy = Traits::ResolveDestroy(library, DestroyInterface);
+            if (!destroy) return result;
+            auto inter = Traits::template Contruct<P...>(library, CreateInterface, args...);
+            if (!inter) return result;
+            result.Reset(library, inter, destroy, &Traits::DestroyRelease);
+            return result;
+        }
+
+    private:
+        const ReloadableLibrary& owner_;
+        internal::EpochReaders::Ticket ticket_;
+        const Generation* generation_;
+        DISALLOW_COPY_AND_ASSIGN(Reader);
+    };
+
+    explicit ReloadableLibrary(const std::shared_ptr<DynamicLibrary>& library)
+        : generation_(new Generation{library, 1}) {}
+
+    virtual ~ReloadableLibrary() { delete generation_.load(); }
+
+    // Loads |path| next to the current generation, resolves |exports| into
+    // its symbol cache and publishes it. Returns false, keeping the current
+    // generation, when the library or one of |exports| can't be loaded.
+    // Waits for the readers of the previous generation.
+    bool Reload(const std::wstring& path, const std::vector<std::string>& exports = std::vector<std::string>()) {
+        auto library = std::make_shared<DynamicLibrary>(path);
+        if (!library->is_valid()) return false;
+        for (const auto& name : exports) {
+            if (!library->GetFunctionPointer(name.c_str())) return false;
+        }
+        return Publish(library);
+    }
+
+    // Publishes |library| as the next generation, see Reload().
+    bool Publish(const std::shared_ptr<DynamicLibrary>& library) {
+        if (!library) return false;
+        std::lock_guard<std::mutex> guard(writer_lock_);
+        auto previous = generation_.load();
+        generation_.store(new Generation{library, previous->version + 1});
+        readers_.Synchronize();
+        delete previous;
+        return true;
+    }
+
+    uint64_t version() const {
+        Reader reader(*this);
+        return reader.version();
+    }
+
+private:
+    mutable internal::EpochReaders readers_;
+    std::atomic<Generation*> generation_;
+    std::mutex writer_lock_;
+    DISALLOW_COPY_AND_ASSIGN(ReloadableLibrary);
+};
+
+} // namespace utils
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_RELOAD_INCLUDE_H_
@@ -0,0 +1,274 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 The Authors of ANT(http:://ant.sh) . All Rights Reserved. 
+// Use of this source code is governed by a BSD-style license that can be 
+// found in the LICENSE file. 
+//
+///////////////////////////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef UTILS_DYNAMIC_LIBRARY_REPLICATED_INCLUDE_H_
+#define UTILS_DYNAMIC_LIBRARY_REPLICATED_INCLUDE_H_
+
+#include <map>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "dynamic_library_interface.h"
+
+#if !defined(_WIN32) && defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace internal {
+
+// The processors of the machine and the NUMA node of each, read once. A
+// processor is numbered group * 64 + number on Windows, by its cpu number
+// elsewhere.
+class ProcessorTopology {
+ public:
+  static constexpr int kNoProcessor = -1;
+
+  static ProcessorTopology* GetInstance() {
+    static ProcessorTopology* instance = new ProcessorTopology();
+    return instance;
+  }
+
+  // Indexed by processor, the node of each or kNoProcessor where there is
+  // none.
+  const std::vector<int>& nodes() const { return nodes_; }
+
+  // The processor running the calling thread, cheap enough for every call.
+  static size_t CurrentProcessor();
+
+  // Runs |task| on a thread of its own bound to |processors|, so that what it
+  // allocates lands on their node, and waits for it.
+  static void RunOn(const std::vector<size_t>& processors,
+                    const std::function<void()>& task);
+
+ private:
+  ProcessorTopology();
+
+  std::vector<int> nodes_;
+  DISALLOW_COPY_AND_ASSIGN(ProcessorTopology);
+};
+
+#if defined(_WIN32)
+
+inline ProcessorTopology::ProcessorTopology() {
+  WORD groups = ::GetActiveProcessorGroupCount();
+  nodes_.assign(groups * 64, kNoProcessor);
+  for (WORD group = 0; group < groups; ++group) {
+    DWORD count = ::GetActiveProcessorCount(group);
+    for (DWORD number = 0; number < count && number < 64; ++number) {
+      PROCESSOR_NUMBER processor = {};
+      processor.Group = group;
+      processor.Number = static_cast<BYTE>(number);
+      USHORT node = 0;
+      if (!::GetNumaProcessorNodeEx(&processor, &node)) node = 0;
+      nodes_[group * 64 + number] = node;
+    }
+  }
+}
+
+inline size_t ProcessorTopology::CurrentProcessor() {
+  PROCESSOR_NUMBER processor = {};
+  ::GetCurrentProcessorNumberEx(&processor);
+  return processor.Group * 64 + processor.Number;
+}
+
+inline void ProcessorTopology::RunOn(const std::vector<size_t>& processors,
+                                     const std::function<void()>& task) {
+  std::thread thread([&processors, &task] {
+    // A thread is bound to a single group, the first processor's.
+    GROUP_AFFINITY affinity = {};
+    if (!processors.empty()) affinity.Group = static_cast<WORD>(processors[0] / 64);
+    for (size_t processor : processors) {
+      if (processor / 64 != affinity.Group) continue;
+      affinity.Mask |= static_cast<KAFFINITY>(1) << (processor % 64);
+    }
+    if (affinity.Mask) ::SetThreadGroupAffinity(::GetCurrentThread(), &affinity, nullptr);
+    task();
+  });
+  thread.join();
+}
+
+#elif defined(__linux__)
+
+// Parses a sysfs cpu list, "0-3,8-11".
+inline std::vector<size_t> ParseCpuList(const std::string& list) {
+  std::vector<size_t> result;
+  const char* cursor = list.c_str();
+  while (*cursor != '\0' && *cursor != '\n') {
+    char* end = nullptr;
+    size_t first = strtoul(cursor, &end, 10);
+    if (end == cursor) break;
+    size_t last = first;
+    if (*end == '-') {
+      cursor = end + 1;
+      last = strtoul(cursor, &end, 10);
+      if (end == cursor) break;
+    }
+    for (size_t cpu = first; cpu <= last; ++cpu) result.push_back(cpu);
+    cursor = *end == ',' ? end + 1 : end;
+  }
+  return result;
+}
+
+inline ProcessorTopology::ProcessorTopology() {
+  long count = ::sysconf(_SC_NPROCESSORS_CONF);
+  nodes_.assign(count > 0 ? count : 1, 0);
+  // Without sysfs' node directory, everything is on node 0.
+  for (int node = 0;; ++node) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (!file) {
+      // Nodes may be numbered sparsely, look past the gaps below 64.
+      if (node >= 64) break;
+      continue;
+    }
+    std::string list;
+    std::getline(file, list);
+    for (size_t cpu : ParseCpuList(list)) {
+      if (cpu >= nodes_.size()) nodes_.resize(cpu + 1, kNoProcessor);
+      nodes_[cpu] = node;
+    }
+  }
+}
+
+inline size_t ProcessorTopology::CurrentProcessor() {
+  int cpu = ::sched_getcpu();
+  return cpu < 0 ? 0 : cpu;
+}
+
+inline void ProcessorTopology::RunOn(const std::vector<size_t>& processors,
+                                     const std::function<void()>& task) {
+  std::thread thread([&processors, &task] {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t processor : processors) {
+      if (processor < CPU_SETSIZE) CPU_SET(processor, &set);
+    }
+    if (CPU_COUNT(&set) != 0) ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    task();
+  });
+  thread.join();
+}
+
+#else
+
+inline ProcessorTopology::ProcessorTopology() : nodes_(1, 0) {}
+
+inline size_t ProcessorTopology::CurrentProcessor() { return 0; }
+
+inline void ProcessorTopology::RunOn(const std::vector<size_t>& processors,
+                                     const std::function<void()>& task) {
+  task();
+}
+
+#endif  // defined(_WIN32)
+
+}  // namespace internal
+
+
+namespace utils {
+
+enum class ReplicaPlacement {
+    // One replica per NUMA node, shared by the node's processors.
+    kPerNode,
+    // One replica per processor.
+    kPerProcessor,
+};
+
+// One native object per NUMA node, or per processor, behind a single handle,
+// for the objects used from every core on each request. Each replica is
+// created on a thread bound to the processors it serves, so that the plugin's
+// allocations for it land on their node, and get() returns the one of the
+// calling thread's processor, with a table lookup.
+//
+//   utils::ReplicatedInterface<Foo> foo(library, "CreateFoo", "DestroyFoo",
+//                                       utils::ReplicaPlacement::kPerNode, 42);
+//   foo->Bar();
+//
+// Every replica is created with the same arguments, and the objects must
+// allow the calls from any thread, a thread may be migrated by the time it
+// uses the replica it was given. The library stays loaded as long as this
+// object.
+template<typename NativeInterface, typename DestructTraits = subtle::Pointer<NativeInterface>>
+class ReplicatedInterface {
+public:
+    using Traits = subtle::NativeTraits<NativeInterface, DestructTraits>;
+    using DestroyFunction = typename Traits::DestroyFunction;
+
+    template<typename... P>
+    explicit ReplicatedInterface(const std::shared_ptr<DynamicLibrary>& library, const std::string& CreateInterface,
+                                 const std::string& DestroyInterface, ReplicaPlacement placement, P... args)
+        : library_(library) {
+        if (!library) return;
+        destroy_ = Traits::ResolveDestroy(library, DestroyInterface);
+        auto create = Traits::template ResolveCreate<P...>(library, CreateInterface);
+        if (!create || !destroy_) return;
+        Create(placement, [create, &args...] { return create(args...); });
+    }
+
+    virtual ~ReplicatedInterface() {
+        for (auto inter : replicas_) {
+            if (inter) DestructTraits::Destroy(destroy_, inter);
+        }
+    }
+
+    // False when a replica couldn't be created.
+    bool is_valid() const {
+        if (replicas_.empty()) return false;
+        for (auto inter : replicas_) {
+            if (!inter) return false;
+        }
+        return true;
+    }
+
+    // The replica of the calling thread's processor.
+    NativeInterface* get() const {
+        size_t processor = internal::ProcessorTopology::CurrentProcessor();
+        if (processor >= replica_of_.size()) return replicas_.empty() ? nullptr : replicas_[0];
+        return replicas_[replica_of_[processor]];
+    }
+
+    NativeInterface* operator->() const { return get(); }
+    NativeInterface& operator*() const { return *get(); }
+    explicit operator bool() const { return is_valid(); }
+
+    size_t size() const { return replicas_.size(); }
+    NativeInterface* at(size_t index) const { return replicas_[index]; }
+
+private:
+    void Create(ReplicaPlacement placement, const std::function<NativeInterface*()>& create) {
+        const auto& nodes = internal::ProcessorTopology::GetInstance()->nodes();
+        // The processors of each replica, by node or processor.
+        std::map<size_t, std::vector<size_t>> domains;
+        for (size_t processor = 0; processor < nodes.size(); ++processor) {
+            if (nodes[processor] == internal::ProcessorTopology::kNoProcessor) continue;
+            size_t domain = placement == ReplicaPlacement::kPerNode ? nodes[processor] : processor;
+            domains[domain].push_back(processor);
+        }
+        replica_of_.assign(nodes.size(), 0);
+        for (const auto& domain : domains) {
+            NativeInterface* inter = nullptr;
+            internal::ProcessorTopology::RunOn(domain.second, [&inter, &create] { inter = create(); });
+            for (size_t processor : domain.second) replica_of_[processor] = static_cast<uint32_t>(replicas_.size());
+            replicas_.push_back(inter);
+        }
+    }
+
+    std::shared_ptr<DynamicLibrary> library_;
+    DestroyFunction destroy_ = nullptr;
+    std::vector<NativeInterface*> replicas_;
+    // Indexed by processor.
+    std::vector<uint32_t> replica_of_;
+    DISALLOW_COPY_AND_ASSIGN(ReplicatedInterface);
+};
+
+} // namespace utils
+
+#endif  // !UTILS_DYNAMIC_LIBRARY_REPLICATED_INCLUDE_H_